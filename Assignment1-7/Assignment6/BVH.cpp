@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include "BVH.hpp"
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
@@ -7,8 +8,7 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
       primitives(std::move(p))
 {
-    time_t start, stop;
-    time(&start);
+    auto start = std::chrono::high_resolution_clock::now();
     if (primitives.empty())
         return;
 
@@ -16,18 +16,28 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
         root = recursiveBuild(primitives);
     }
     else {
-        root = recursiveBuildBySVH(primitives);
+        root = recursiveBuildBySVH(primitives.begin(), primitives.end());
     }
 
-    time(&stop);
-    double diff = difftime(stop, start);
-    int hrs = (int)diff / 3600;
-    int mins = ((int)diff / 60) - (hrs * 60);
-    int secs = (int)diff - (hrs * 3600) - (mins * 60);
+    auto stop = std::chrono::high_resolution_clock::now();
+    printf("\rBVH Generation complete: \nTime Taken: %.3f ms, SAH cost: %.3f\n\n",
+           std::chrono::duration<double, std::milli>(stop - start).count(), SAHCost());
+}
 
-    printf(
-        "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
-        hrs, mins, secs);
+// ÿڵıϱ (ڲڵ)  (Ҷ) Ĵ, Ըڵı
+double BVHAccel::SAHCost() const
+{
+    if (!root)
+        return 0;
+    return subtreeCost(root) / root->bounds.SurfaceArea();
+}
+
+double BVHAccel::subtreeCost(BVHBuildNode* node) const
+{
+    double area = node->bounds.SurfaceArea();
+    if (!node->left && !node->right)
+        return intersectionCost * area;     // Ҷֻһ
+    return traversalCost * area + subtreeCost(node->left) + subtreeCost(node->right);
 }
 
 BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
@@ -101,99 +111,93 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
 
 
 
-// ʽ
-BVHBuildNode* BVHAccel::recursiveBuildBySVH(std::vector<Object*> objects)
+// ʽ:  [begin, end) ԭػ, İֽɸͰ,
+// ɨһõÿλİΧк, ѡСĻ
+BVHBuildNode* BVHAccel::recursiveBuildBySVH(std::vector<Object*>::iterator begin,
+                                            std::vector<Object*>::iterator end)
 {
     BVHBuildNode* node = new BVHBuildNode();
 
     // Compute bounds of all primitives in BVH node
-    Bounds3 bounds;
-    for (int i = 0; i < objects.size(); ++i)
-        bounds = Union(bounds, objects[i]->getBounds());   // ȡΧ 
-    if (objects.size() == 1) {
+    Bounds3 bounds, centroidBounds;
+    for (auto it = begin; it != end; ++it) {
+        Bounds3 b = (*it)->getBounds();
+        bounds = Union(bounds, b);   // ȡΧ 
+        centroidBounds = Union(centroidBounds, b.Centroid());
+    }
+    if (end - begin == 1) {
         // Create leaf _BVHBuildNode_
-        node->bounds = objects[0]->getBounds();
-        node->object = objects[0];
+        node->bounds = bounds;
+        node->object = *begin;
         node->left = nullptr;
         node->right = nullptr;
         return node;
     }
-    else if (objects.size() == 2) {
-        node->left = recursiveBuildBySVH(std::vector{ objects[0] });
-        node->right = recursiveBuildBySVH(std::vector{ objects[1] });
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        return node;
-    }
-    else {
-        Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)    // ȡΧ
-            centroidBounds =
-            Union(centroidBounds, objects[i]->getBounds().Centroid());
-        int dim = centroidBounds.maxExtent();   // ı߸ʹı߲
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                    f2->getBounds().Centroid().x;
-                });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                    f2->getBounds().Centroid().y;
-                });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                    f2->getBounds().Centroid().z;
-                });
-            break;
+    int dim = centroidBounds.maxExtent();   // ı߸ʹı߲
+    auto centroidOf = [dim](Object* object) { return object->getBounds().Centroid()[dim]; };
+    auto middling = begin + (end - begin) / 2;
+
+    // Ѱѻ
+    constexpr int bucketSize = 12;    // ֳɶͰ
+    double extent = centroidBounds.pMax[dim] - centroidBounds.pMin[dim];
+    int pos = -1;
+    auto bucketOf = [&](Object* object) {
+        int b = (int)(bucketSize * (centroidOf(object) - centroidBounds.pMin[dim]) / extent);
+        return std::min(std::max(b, 0), bucketSize - 1);
+    };
+    if (end - begin > 2 && extent > 0) {
+        int count[bucketSize] = {};
+        Bounds3 bucketBounds[bucketSize];
+        for (auto it = begin; it != end; ++it) {
+            int b = bucketOf(*it);
+            count[b]++;
+            bucketBounds[b] = Union(bucketBounds[b], (*it)->getBounds());
+        }
+
+        // ۻͰ [i, bucketSize) 
+        double rightArea[bucketSize];
+        int rightCount[bucketSize];
+        Bounds3 rightBound;
+        int n = 0;
+        for (int i = bucketSize - 1; i > 0; --i) {
+            rightBound = Union(rightBound, bucketBounds[i]);
+            n += count[i];
+            rightArea[i] = n ? rightBound.SurfaceArea() : 0;
+            rightCount[i] = n;
         }
 
-        // Ѱѻ
-        int bucketSize = 32;    // ֳɶͰ
         double boundsArea = bounds.SurfaceArea();  // ,ͨø
         double minCost = std::numeric_limits<double>::max();
-        int pos = 0;
-        for (int i = 1; i < bucketSize; ++i) {
-            auto mid = objects.begin() + objects.size() * i / bucketSize;
-            std::vector<Object*> left(objects.begin(), mid);
-            std::vector<Object*> right(mid, objects.end());
-            // ȡΧΧе
-            Bounds3 leftBound, rightBound;
-            for (std::size_t i = 0; i < left.size(); ++i) {
-                leftBound = Union(leftBound, objects[i]->getBounds());   // ȡΧ 
-            }
-            for (std::size_t i = 0; i < right.size(); ++i) {
-                rightBound = Union(rightBound, objects[i]->getBounds());   // ȡΧ 
-            }
-            double pLeft = leftBound.SurfaceArea() / boundsArea;
-            double pRight = rightBound.SurfaceArea() / boundsArea;
+        Bounds3 leftBound;
+        n = 0;
+        for (int i = 0; i < bucketSize - 1; ++i) {
+            leftBound = Union(leftBound, bucketBounds[i]);
+            n += count[i];
+            if (n == 0 || rightCount[i + 1] == 0)
+                continue;
             // ÿཻʱȣʹ n ԱʾðΧཻĺʱ
-            double cost = pLeft * left.size() + pRight * right.size();
+            double cost = (n * leftBound.SurfaceArea() + rightCount[i + 1] * rightArea[i + 1]) / boundsArea;
             if (cost < minCost) {
                 minCost = cost;
                 pos = i;
             }
         }
+    }
 
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + objects.size() * pos / bucketSize;
-        auto ending = objects.end();
-
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
-
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
-
-        node->left = recursiveBuildBySVH(leftshapes);
-        node->right = recursiveBuildBySVH(rightshapes);
-
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-
+    if (pos >= 0) {
+        middling = std::partition(begin, end, [&](Object* object) { return bucketOf(object) <= pos; });
     }
+    else {
+        // ̫ٻغʱλ
+        std::nth_element(begin, middling, end, [&](Object* f1, Object* f2) {
+            return centroidOf(f1) < centroidOf(f2);
+        });
+    }
+
+    node->left = recursiveBuildBySVH(begin, middling);
+    node->right = recursiveBuildBySVH(middling, end);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
 
     return node;
 }
@@ -37,11 +37,18 @@ public:
     bool IntersectP(const Ray &ray) const;
     BVHBuildNode* root;
 
+    double SAHCost() const;
+
     // BVHAccel Private Methods
     BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
-    BVHBuildNode* recursiveBuildBySVH(std::vector<Object*>objects);
+    BVHBuildNode* recursiveBuildBySVH(std::vector<Object*>::iterator begin,
+                                      std::vector<Object*>::iterator end);
+    double subtreeCost(BVHBuildNode* node) const;
 
     // BVHAccel Private Data
+    // SAH һΰΧбһ󽻵Դ
+    static constexpr double traversalCost = 1.0;
+    static constexpr double intersectionCost = 1.0;
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<Object*> primitives;
@@ -0,0 +1,84 @@
+//
+// Alias method (Walker / Vose) for O(1) sampling of a discrete distribution.
+//
+
+#ifndef RAYTRACING_ALIASTABLE_H
+#define RAYTRACING_ALIASTABLE_H
+
+#include <algorithm>
+#include <vector>
+
+// 建表 O(n), 之后每次采样只需要一个随机数和一次查表.
+// 第 i 格以概率 q 取 i, 否则取 alias, 每格的总概率都是 1/n.
+class AliasTable
+{
+public:
+    AliasTable() = default;
+
+    // weights 不必归一化, 全为 0 时退化成均匀分布
+    explicit AliasTable(const std::vector<float>& weights)
+    {
+        int n = (int)weights.size();
+        bins.resize(n);
+        double sum = 0;
+        for (float w : weights)
+            sum += std::max(w, 0.0f);
+
+        // p 是每一格相对 1/n 的比例, 小于 1 的需要从大于 1 的格子借
+        std::vector<double> p(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i) {
+            double pmf = sum > 0 ? std::max(weights[i], 0.0f) / sum : 1.0 / n;
+            bins[i].pmf = (float)pmf;
+            p[i] = pmf * n;
+            if (p[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            large.pop_back();
+            bins[s].q = (float)p[s];
+            bins[s].alias = l;
+            p[l] = (p[l] + p[s]) - 1;
+            if (p[l] < 1)
+                small.push_back(l);
+            else
+                large.push_back(l);
+        }
+        // 剩下的格子只差舍入误差, 直接当作 1
+        for (int i : small)
+            bins[i].q = 1;
+        for (int i : large)
+            bins[i].q = 1;
+    }
+
+    // u 在 [0, 1) 内, pmf 返回选中下标的概率
+    int Sample(float u, float* pmf = nullptr) const
+    {
+        int n = (int)bins.size();
+        float x = u * n;
+        int i = std::min((int)x, n - 1);
+        int index = x - i < bins[i].q ? i : bins[i].alias;
+        if (pmf)
+            *pmf = bins[index].pmf;
+        return index;
+    }
+
+    float PMF(int index) const { return bins[index].pmf; }
+    int size() const { return (int)bins.size(); }
+    bool empty() const { return bins.empty(); }
+
+private:
+    struct Bin
+    {
+        float q = 1;
+        float pmf = 0;
+        int alias = 0;
+    };
+    std::vector<Bin> bins;
+};
+
+#endif //RAYTRACING_ALIASTABLE_H
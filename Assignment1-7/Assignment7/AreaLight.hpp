@@ -7,6 +7,7 @@
 #include "Vector.hpp"
 #include "Light.hpp"
 #include "global.hpp"
+#include "Sampler.hpp"
 
 class AreaLight : public Light
 {
@@ -19,11 +20,10 @@ public:
         length = 100;
     }
 
-    Vector3f SamplePoint() const
+    Vector3f SamplePoint(Sampler &sampler) const
     {
-        auto random_u = get_random_float();
-        auto random_v = get_random_float();
-        return position + random_u * u + random_v * v;
+        Vector2f random_uv = sampler.Get2D();
+        return position + random_uv.x * u + random_uv.y * v;
     }
 
     float length;
@@ -1,248 +1,1175 @@
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include "BVH.hpp"
+#include "Parallel.hpp"
+
+struct BVHPrimitiveInfo {
+    BVHPrimitiveInfo() {}
+    BVHPrimitiveInfo(int primitiveNumber, const Bounds3& bounds)
+        : primitiveNumber(primitiveNumber), bounds(bounds),
+          centroid(0.5 * bounds.pMin + 0.5 * bounds.pMax) {}
+    int primitiveNumber;
+    Bounds3 bounds;
+    Vector3f centroid;
+};
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
-                   SplitMethod splitMethod)
+                   SplitMethod splitMethod, TreeWidth treeWidth)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+      primitives(std::move(p)), treeWidth(treeWidth)
 {
-    time_t start, stop;
-    time(&start);
     if (primitives.empty())
         return;
-    if (0) {
-        root = recursiveBuildBySVH(primitives);
-    }
-    else {
-        root = recursiveBuild(primitives);
-    }
+    std::vector<Bounds3> bounds(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        bounds[i] = primitives[i]->getBounds();
+    build(bounds);
+
+    // 尴Ҷӵ˳, Ҷֱ primitives е
+    std::vector<Object*> orderedPrims(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        orderedPrims[i] = primitives[primitiveOrder[i]];
+    primitives.swap(orderedPrims);
+    std::vector<int>().swap(primitiveOrder);
+}
+
+BVHAccel::BVHAccel(const std::vector<Bounds3>& bounds, int maxPrimsInNode,
+                   SplitMethod splitMethod, TreeWidth treeWidth)
+    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod), treeWidth(treeWidth)
+{
+    if (bounds.empty())
+        return;
+    build(bounds);
+    // ûԲ, õĽڵѾû
+    deleteBuildTree(root);
+    root = nullptr;
+}
+
+void BVHAccel::build(const std::vector<Bounds3>& bounds)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // ֻƶ primitiveInfo ±, Ҷӵ˳ primitiveOrder 
+    std::vector<BVHPrimitiveInfo> primitiveInfo(bounds.size());
+    for (size_t i = 0; i < bounds.size(); ++i)
+        primitiveInfo[i] = BVHPrimitiveInfo((int)i, bounds[i]);
+
+    primitiveOrder.clear();
+    primitiveOrder.reserve(bounds.size());
+    if (splitMethod == SplitMethod::HLBVH)
+        root = hlbvhBuild(primitiveInfo, primitiveOrder);
+    else
+        root = recursiveBuild(primitiveInfo, 0, (int)bounds.size(), primitiveOrder);
 
+    // ѹƽ
+    nodes.resize(totalNodes);
+    int offset = 0;
+    flattenBVHTree(root, &offset);
 
-    time(&stop);
-    double diff = difftime(stop, start);
-    int hrs = (int)diff / 3600;
-    int mins = ((int)diff / 60) - (hrs * 60);
-    int secs = (int)diff - (hrs * 3600) - (mins * 60);
+    // ٰѶϲɿ BVH, ָ֧ʱ˻ظխ
+    treeWidth = SupportedWidth(treeWidth);
+    this->treeWidth = treeWidth;
+    if (treeWidth == TreeWidth::BVH4)
+        collapseWide(0, wideNodes4);
+    else if (treeWidth == TreeWidth::BVH8)
+        collapseWide(0, wideNodes8);
 
-    printf(
-        "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
-        hrs, mins, secs);
+    auto stop = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+    int wideNodeCount = treeWidth == TreeWidth::BVH4 ? (int)wideNodes4.size()
+                      : treeWidth == TreeWidth::BVH8 ? (int)wideNodes8.size() : totalNodes;
+    printf("\rBVH Generation complete: %d primitives, %d nodes, %s, %d-wide (%d nodes)\n"
+           "Time Taken: %.3f ms, SAH cost: %.3f\n\n",
+           (int)bounds.size(), totalNodes,
+           splitMethod == SplitMethod::SAH ? "SAH" : splitMethod == SplitMethod::HLBVH ? "HLBVH" : "NAIVE",
+           (int)treeWidth, wideNodeCount,
+           ms, SAHCost());
 }
 
-BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
+BVHAccel::BVHAccel(std::vector<Object*> p, MappedArray<LinearBVHNode> nodes,
+                   MappedArray<WideBVHNode<4>> wideNodes4, MappedArray<WideBVHNode<8>> wideNodes8,
+                   int maxPrimsInNode, SplitMethod splitMethod, TreeWidth treeWidth)
+    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
+      primitives(std::move(p)), nodes(std::move(nodes)), totalNodes((int)this->nodes.size()),
+      treeWidth(treeWidth), wideNodes4(std::move(wideNodes4)), wideNodes8(std::move(wideNodes8))
+{
+}
+
+BVHAccel::TreeWidth BVHAccel::SupportedWidth(TreeWidth treeWidth)
+{
+    if (treeWidth == TreeWidth::BVH8 && !CpuSupportsAVX2())
+        treeWidth = TreeWidth::BVH4;
+    if (treeWidth == TreeWidth::BVH4 && !CpuSupportsSSE())
+        treeWidth = TreeWidth::BINARY;
+    return treeWidth;
+}
+
+BVHBuildNode* BVHAccel::createLeaf(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                                   const Bounds3& bounds, std::vector<int>& order)
 {
     BVHBuildNode* node = new BVHBuildNode();
+    ++totalNodes;
+    node->bounds = bounds;
+    node->firstPrimOffset = (int)order.size();
+    node->nPrimitives = end - start;
+    node->area = 0;
+    for (int i = start; i < end; ++i) {
+        int primitiveNumber = primitiveInfo[i].primitiveNumber;
+        order.push_back(primitiveNumber);
+        // ֻΧнʱû, ҲͲܲ
+        if (!primitives.empty())
+            node->area += primitives[primitiveNumber]->getArea();
+    }
+    return node;
+}
 
+//  primitiveInfo  [start, end) ԭؽ
+BVHBuildNode* BVHAccel::recursiveBuild(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                                       std::vector<int>& order)
+{
     // Compute bounds of all primitives in BVH node
     Bounds3 bounds;
-    for (int i = 0; i < objects.size(); ++i)
-        bounds = Union(bounds, objects[i]->getBounds());
-    if (objects.size() == 1) {
-        // Create leaf _BVHBuildNode_
-        node->bounds = objects[0]->getBounds();
-        node->object = objects[0];
-        node->left = nullptr;
-        node->right = nullptr;
-        node->area = objects[0]->getArea();
-        return node;
-    }
-    else if (objects.size() == 2) {
-        node->left = recursiveBuild(std::vector{objects[0]});
-        node->right = recursiveBuild(std::vector{objects[1]});
+    for (int i = start; i < end; ++i)
+        bounds = Union(bounds, primitiveInfo[i].bounds);
+    int nPrimitives = end - start;
+    // NAIVE ûдģ, ŵ¾ֱӽҶ; SAH  partitionSAH ȽҶӺͻֵĴ
+    if (nPrimitives == 1 || (splitMethod == SplitMethod::NAIVE && nPrimitives <= maxPrimsInNode))
+        return createLeaf(primitiveInfo, start, end, bounds, order);
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        node->area = node->left->area + node->right->area;
-        return node;
+    Bounds3 centroidBounds;
+    for (int i = start; i < end; ++i)
+        centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+    int dim = centroidBounds.maxExtent();   // ı߸ʹı߲
+
+    int mid = (start + end) / 2;
+    if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+        // غ, ûռ仮, ܷŽһҶӾֱӽҶ, ԰
+        if (nPrimitives <= maxPrimsInNode)
+            return createLeaf(primitiveInfo, start, end, bounds, order);
+    }
+    else if (splitMethod == SplitMethod::NAIVE) {
+        // λ, nth_element ֻҪ O(n)
+        std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end - 1] + 1,
+                         [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
     }
     else {
-        Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)
-            centroidBounds =
-                Union(centroidBounds, objects[i]->getBounds().Centroid());
-        int dim = centroidBounds.maxExtent();
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                       f2->getBounds().Centroid().x;
-            });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                       f2->getBounds().Centroid().y;
-            });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                       f2->getBounds().Centroid().z;
-            });
-            break;
+        mid = partitionSAH(primitiveInfo, start, end, bounds, centroidBounds, dim);
+        if (mid < 0)
+            return createLeaf(primitiveInfo, start, end, bounds, order);
+    }
+
+    BVHBuildNode* node = new BVHBuildNode();
+    ++totalNodes;
+    node->splitAxis = dim;
+    node->left = recursiveBuild(primitiveInfo, start, mid, order);
+    node->right = recursiveBuild(primitiveInfo, mid, end, order);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
+
+// ʽ: İֽɸͰ, ɨһõÿλ
+// İΧк, ѡСĻ. ҶӸ򷵻 -1.
+int BVHAccel::partitionSAH(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                           const Bounds3& bounds, const Bounds3& centroidBounds, int dim)
+{
+    constexpr int nBuckets = 12;
+    struct BucketInfo {
+        int count = 0;
+        Bounds3 bounds;
+    };
+    BucketInfo buckets[nBuckets];
+    auto bucketOf = [&](const BVHPrimitiveInfo& info) {
+        int b = (int)(nBuckets * centroidBounds.Offset(info.centroid)[dim]);
+        return std::min(std::max(b, 0), nBuckets - 1);
+    };
+    for (int i = start; i < end; ++i) {
+        BucketInfo& bucket = buckets[bucketOf(primitiveInfo[i])];
+        bucket.count++;
+        bucket.bounds = Union(bucket.bounds, primitiveInfo[i].bounds);
+    }
+
+    // ۻ, suffixArea[i] / suffixCount[i] Ͱ [i, nBuckets) 
+    double suffixArea[nBuckets];
+    int suffixCount[nBuckets];
+    Bounds3 rightBound;
+    int rightCount = 0;
+    for (int i = nBuckets - 1; i > 0; --i) {
+        rightBound = Union(rightBound, buckets[i].bounds);
+        rightCount += buckets[i].count;
+        suffixArea[i] = rightCount ? rightBound.SurfaceArea() : 0;
+        suffixCount[i] = rightCount;
+    }
+
+    // ɨ, Ͱ i ֮󻮷ֵĴ
+    double boundsArea = bounds.SurfaceArea();  // ,ͨø
+    double minCost = std::numeric_limits<double>::max();
+    int minCostSplitBucket = -1;
+    Bounds3 leftBound;
+    int leftCount = 0;
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        leftBound = Union(leftBound, buckets[i].bounds);
+        leftCount += buckets[i].count;
+        if (leftCount == 0 || suffixCount[i + 1] == 0)
+            continue;
+        double cost = traversalCost + intersectionCost *
+            (leftCount * leftBound.SurfaceArea() + suffixCount[i + 1] * suffixArea[i + 1]) / boundsArea;
+        if (cost < minCost) {
+            minCost = cost;
+            minCostSplitBucket = i;
         }
+    }
 
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + (objects.size() / 2);
-        auto ending = objects.end();
+    // ҶӵĴ۾Ǻÿ
+    int nPrimitives = end - start;
+    double leafCost = intersectionCost * nPrimitives;
+    if (nPrimitives <= maxPrimsInNode && (minCostSplitBucket < 0 || leafCost <= minCost))
+        return -1;
+    if (minCostSplitBucket < 0) {
+        // ĶͬһͰ, ˻ɰλ
+        int mid = (start + end) / 2;
+        std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end - 1] + 1,
+                         [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+        return mid;
+    }
 
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
+    BVHPrimitiveInfo* pmid = std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+        [&](const BVHPrimitiveInfo& info) { return bucketOf(info) <= minCostSplitBucket; });
+    return (int)(pmid - &primitiveInfo[0]);
+}
 
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+// HLBVH: ĵ Morton , ĸλͬͼԪһ treelet,  treelet λ
+// в;  treelet ĸ SAH .  treelet ǲе, ֻмǧڵ
+struct MortonPrimitive {
+    int primitiveIndex;     // primitiveInfo е±
+    uint32_t mortonCode;
+};
 
-        node->left = recursiveBuild(leftshapes);
-        node->right = recursiveBuild(rightshapes);
+namespace {
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        node->area = node->left->area + node->right->area;
+// ͼԪʱ̵߳ʡµʱ, н
+constexpr int kParallelBuildThreshold = 1 << 14;
+// 30 λ Morton , ÿ 10 λ
+constexpr int kMortonBits = 10;
+constexpr int kMortonScale = 1 << kMortonBits;
+//  12 λͬͼԪһ treelet ,  4096  treelet
+constexpr int kTreeletBits = 12;
+constexpr uint32_t kTreeletMask = ((1u << kTreeletBits) - 1) << (3 * kMortonBits - kTreeletBits);
+
+//  10 λÿһλλ: ...b2 b1 b0 -> ...b2 0 0 b1 0 0 b0
+inline uint32_t LeftShift3(uint32_t x)
+{
+    if (x == (1u << 10))
+        --x;
+    x = (x | (x << 16)) & 0b00000011000000000000000011111111;
+    x = (x | (x << 8)) & 0b00000011000000001111000000001111;
+    x = (x | (x << 4)) & 0b00000011000011000011000011000011;
+    x = (x | (x << 2)) & 0b00001001001001001001001001001001;
+    return x;
+}
+
+// v ĸ [0, kMortonScale] .  3k, 3k + 1, 3k + 2 λֱ x, y, z
+inline uint32_t EncodeMorton3(const Vector3f& v)
+{
+    return (LeftShift3((uint32_t)v.z) << 2) | (LeftShift3((uint32_t)v.y) << 1) | LeftShift3((uint32_t)v.x);
+}
+
+//  Morton  LSD , ÿ 6 λ. ÿһȲͰ, ǰ׺, ٲȶдĿλ
+void RadixSort(std::vector<MortonPrimitive>& primitives, int nThreads)
+{
+    constexpr int bitsPerPass = 6;
+    constexpr int nPasses = 3 * kMortonBits / bitsPerPass;
+    constexpr int nBuckets = 1 << bitsPerPass;
+    constexpr int bitMask = nBuckets - 1;
+    int n = (int)primitives.size();
+    int nChunks = std::max(1, std::min(4 * nThreads, n / 4096));
+    std::vector<MortonPrimitive> temp(n);
+    std::vector<std::array<int, nBuckets>> offsets(nChunks);
+    for (int pass = 0; pass < nPasses; ++pass) {
+        int lowBit = pass * bitsPerPass;
+        const std::vector<MortonPrimitive>& in = (pass & 1) ? temp : primitives;
+        std::vector<MortonPrimitive>& out = (pass & 1) ? primitives : temp;
+        auto chunkBegin = [&](int c) { return (int)((long long)n * c / nChunks); };
+
+        ParallelFor(nChunks, [&](int c, int) {
+            offsets[c].fill(0);
+            for (int i = chunkBegin(c); i < chunkBegin(c + 1); ++i)
+                ++offsets[c][(in[i].mortonCode >> lowBit) & bitMask];
+        }, nThreads);
+        // ͰΪ, Ϊ, ȶ
+        int offset = 0;
+        for (int b = 0; b < nBuckets; ++b) {
+            for (int c = 0; c < nChunks; ++c) {
+                int count = offsets[c][b];
+                offsets[c][b] = offset;
+                offset += count;
+            }
+        }
+        ParallelFor(nChunks, [&](int c, int) {
+            for (int i = chunkBegin(c); i < chunkBegin(c + 1); ++i)
+                out[offsets[c][(in[i].mortonCode >> lowBit) & bitMask]++] = in[i];
+        }, nThreads);
     }
+    if (nPasses & 1)
+        primitives.swap(temp);
+}
 
-    return node;
+} // namespace
+
+BVHBuildNode* BVHAccel::hlbvhBuild(std::vector<BVHPrimitiveInfo>& primitiveInfo, std::vector<int>& order)
+{
+    int nPrimitives = (int)primitiveInfo.size();
+    int nThreads = nPrimitives < kParallelBuildThreshold ? 1 : NumSystemCores();
+    Bounds3 centroidBounds;
+    for (const BVHPrimitiveInfo& info : primitiveInfo)
+        centroidBounds = Union(centroidBounds, info.centroid);
+
+    //  [0, 1024] ĸϱ
+    std::vector<MortonPrimitive> mortonPrims(nPrimitives);
+    int nChunks = std::max(1, std::min(4 * nThreads, nPrimitives / 4096));
+    ParallelFor(nChunks, [&](int c, int) {
+        int begin = (int)((long long)nPrimitives * c / nChunks);
+        int end = (int)((long long)nPrimitives * (c + 1) / nChunks);
+        for (int i = begin; i < end; ++i) {
+            Vector3f offset = centroidBounds.Offset(primitiveInfo[i].centroid);
+            // ĳһغʱ Offset Ϊ 0 / 0
+            for (int axis = 0; axis < 3; ++axis) {
+                if (!(offset[axis] >= 0))
+                    offset[axis] = 0;
+            }
+            mortonPrims[i].primitiveIndex = i;
+            mortonPrims[i].mortonCode = EncodeMorton3(offset * kMortonScale);
+        }
+    }, nThreads);
+    RadixSort(mortonPrims, nThreads);
+
+    // λͬһһ treelet
+    struct Treelet {
+        int start, count;
+        BVHBuildNode* root;
+        int nodeCount;
+    };
+    std::vector<Treelet> treelets;
+    for (int start = 0, end = 1; end <= nPrimitives; ++end) {
+        if (end == nPrimitives
+            || (mortonPrims[start].mortonCode & kTreeletMask) != (mortonPrims[end].mortonCode & kTreeletMask)) {
+            treelets.push_back({ start, end - start, nullptr, 0 });
+            start = end;
+        }
+    }
+    ParallelFor((int)treelets.size(), [&](int t, int) {
+        Treelet& treelet = treelets[t];
+        treelet.root = emitLBVH(primitiveInfo, mortonPrims, treelet.start, treelet.count,
+                                3 * kMortonBits - kTreeletBits - 1, treelet.nodeCount);
+    }, nThreads);
+
+    // : ÿ treelet һͼԪ SAH 
+    std::vector<BVHBuildNode*> roots;
+    std::vector<BVHPrimitiveInfo> treeletInfo;
+    for (const Treelet& treelet : treelets) {
+        totalNodes += treelet.nodeCount;
+        treeletInfo.push_back(BVHPrimitiveInfo((int)roots.size(), treelet.root->bounds));
+        roots.push_back(treelet.root);
+    }
+    BVHBuildNode* root = buildUpperSAH(treeletInfo, 0, (int)treeletInfo.size(), roots);
+
+    // Ҷǵλ, ȵ˳±, ͼԪһ
+    order.clear();
+    order.reserve(nPrimitives);
+    renumberLeaves(root, mortonPrims, primitiveInfo, order);
+    return root;
 }
 
+//  [start, start + n) ϰ Morton ĵ bitIndex λ, ͬʱ԰
+BVHBuildNode* BVHAccel::emitLBVH(const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                                 const std::vector<MortonPrimitive>& mortonPrims, int start, int n,
+                                 int bitIndex, int& nodeCount) const
+{
+    BVHBuildNode* node = new BVHBuildNode();
+    ++nodeCount;
+    if (n <= maxPrimsInNode) {
+        node->firstPrimOffset = start;
+        node->nPrimitives = n;
+        node->area = 0;
+        for (int i = start; i < start + n; ++i) {
+            int primitiveNumber = primitiveInfo[mortonPrims[i].primitiveIndex].primitiveNumber;
+            node->bounds = Union(node->bounds, primitiveInfo[mortonPrims[i].primitiveIndex].bounds);
+            if (!primitives.empty())
+                node->area += primitives[primitiveNumber]->getArea();
+        }
+        return node;
+    }
 
+    // һڵ bitIndex λ϶ͬʱλ, ˾Ͷ԰
+    int split = start + n / 2;
+    for (; bitIndex >= 0; --bitIndex) {
+        uint32_t mask = 1u << bitIndex;
+        if ((mortonPrims[start].mortonCode & mask) == (mortonPrims[start + n - 1].mortonCode & mask))
+            continue;
+        split = (int)(std::partition_point(&mortonPrims[start], &mortonPrims[start + n - 1] + 1,
+                                           [mask](const MortonPrimitive& p) { return !(p.mortonCode & mask); })
+                      - &mortonPrims[0]);
+        break;
+    }
+    node->splitAxis = bitIndex >= 0 ? bitIndex % 3 : 0;
+    node->left = emitLBVH(primitiveInfo, mortonPrims, start, split - start, bitIndex - 1, nodeCount);
+    node->right = emitLBVH(primitiveInfo, mortonPrims, split, start + n - split, bitIndex - 1, nodeCount);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
 
-// ʽ
-BVHBuildNode* BVHAccel::recursiveBuildBySVH(std::vector<Object*> objects)
+// treeletInfo  primitiveNumber  roots е±
+BVHBuildNode* BVHAccel::buildUpperSAH(std::vector<BVHPrimitiveInfo>& treeletInfo, int start, int end,
+                                      const std::vector<BVHBuildNode*>& roots)
 {
+    if (end - start == 1)
+        return roots[treeletInfo[start].primitiveNumber];
+
+    Bounds3 bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        bounds = Union(bounds, treeletInfo[i].bounds);
+        centroidBounds = Union(centroidBounds, treeletInfo[i].centroid);
+    }
+    int dim = centroidBounds.maxExtent();
+    // treelet ܷŽҶ, partitionSAH òòغʱ԰
+    int mid = -1;
+    if (centroidBounds.pMax[dim] != centroidBounds.pMin[dim])
+        mid = partitionSAH(treeletInfo, start, end, bounds, centroidBounds, dim);
+    if (mid < 0) {
+        mid = (start + end) / 2;
+        std::nth_element(&treeletInfo[start], &treeletInfo[mid], &treeletInfo[end - 1] + 1,
+                         [dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    }
+
     BVHBuildNode* node = new BVHBuildNode();
+    ++totalNodes;
+    node->splitAxis = dim;
+    node->left = buildUpperSAH(treeletInfo, start, mid, roots);
+    node->right = buildUpperSAH(treeletInfo, mid, end, roots);
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+    return node;
+}
 
-    // Compute bounds of all primitives in BVH node
-    Bounds3 bounds;
-    for (int i = 0; i < objects.size(); ++i)
-        bounds = Union(bounds, objects[i]->getBounds());   // ȡΧ 
-    if (objects.size() == 1) {
-        // Create leaf _BVHBuildNode_
-        node->bounds = objects[0]->getBounds();
-        node->object = objects[0];
-        node->left = nullptr;
-        node->right = nullptr;
-        return node;
+void BVHAccel::renumberLeaves(BVHBuildNode* node, const std::vector<MortonPrimitive>& mortonPrims,
+                              const std::vector<BVHPrimitiveInfo>& primitiveInfo, std::vector<int>& order) const
+{
+    if (node->nPrimitives == 0) {
+        renumberLeaves(node->left, mortonPrims, primitiveInfo, order);
+        renumberLeaves(node->right, mortonPrims, primitiveInfo, order);
+        return;
     }
-    else if (objects.size() == 2) {
-        node->left = recursiveBuildBySVH(std::vector{ objects[0] });
-        node->right = recursiveBuildBySVH(std::vector{ objects[1] });
+    int sortedOffset = node->firstPrimOffset;
+    node->firstPrimOffset = (int)order.size();
+    for (int i = sortedOffset; i < sortedOffset + node->nPrimitives; ++i)
+        order.push_back(primitiveInfo[mortonPrims[i].primitiveIndex].primitiveNumber);
+}
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
-        return node;
+//  SAH , Ըڵһ
+double BVHAccel::SAHCost() const
+{
+    if (nodes.empty())
+        return 0;
+    double cost = 0;
+    for (const LinearBVHNode& node : nodes) {
+        double area = node.bounds.SurfaceArea();
+        if (node.nPrimitives > 0)
+            cost += intersectionCost * node.nPrimitives * area;
+        else
+            cost += traversalCost * area;
     }
-    else {
-        Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)    // ȡΧ
-            centroidBounds =
-            Union(centroidBounds, objects[i]->getBounds().Centroid());
-        int dim = centroidBounds.maxExtent();   // ı߸ʹı߲
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                    f2->getBounds().Centroid().x;
-                });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                    f2->getBounds().Centroid().y;
-                });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                    f2->getBounds().Centroid().z;
-                });
-            break;
-        }
+    return cost / nodes[0].bounds.SurfaceArea();
+}
 
-        // Ѱѻ
-        int bucketSize = 32;    // ֳɶͰ
-        double boundsArea = bounds.SurfaceArea();  // ,ͨø
-        double minCost = std::numeric_limits<double>::max();
-        int pos = 0;
-        for (int i = 1; i < bucketSize; ++i) {
-            auto mid = objects.begin() + objects.size() * i / bucketSize;
-            std::vector<Object*> left(objects.begin(), mid);
-            std::vector<Object*> right(mid, objects.end());
-            // ȡΧΧе
-            Bounds3 leftBound, rightBound;
-            for (std::size_t i = 0; i < left.size(); ++i) {
-                leftBound = Union(leftBound, objects[i]->getBounds());   // ȡΧ 
-            }
-            for (std::size_t i = 0; i < right.size(); ++i) {
-                rightBound = Union(rightBound, objects[i]->getBounds());   // ȡΧ 
-            }
-            double pLeft = leftBound.SurfaceArea() / boundsArea;
-            double pRight = rightBound.SurfaceArea() / boundsArea;
-            // ÿཻʱȣʹ n ԱʾðΧཻĺʱ
-            double cost = pLeft * left.size() + pRight * right.size();
-            if (cost < minCost) {
-                minCost = cost;
-                pos = i;
-            }
+// Update еڵ, ±궼еĽڵ
+struct BVHUpdateState {
+    const std::vector<Bounds3>* bounds;     // ǰҶӵ˳
+    std::vector<int> first, count;          // ǵͼԪ
+    std::vector<float> cost;                // ڵ SAH 
+    std::vector<char> rebuild;
+    std::vector<int> order;                 // µҶ˳
+    std::vector<float> newRefCost;          // , ؽĽڵȼǳ -1
+};
+
+bool BVHAccel::Update(const std::vector<Bounds3>& bounds, float maxCostRatio)
+{
+    if (nodes.empty())
+        return false;
+    std::vector<Bounds3> objectBounds;
+    if (bounds.empty()) {
+        objectBounds.resize(primitives.size());
+        for (size_t i = 0; i < primitives.size(); ++i)
+            objectBounds[i] = primitives[i]->getBounds();
+    }
+    BVHUpdateState state;
+    state.bounds = bounds.empty() ? &objectBounds : &bounds;
+    // οȡһθ֮ǰ, ҲǸս (ӻ) 
+    if (refCost.size() != nodes.size())
+        subtreeCosts(refCost);
+
+    // refit: ӵ±ܱȸڵ, ɨһԵ
+    nodes.detach();
+    int nNodes = (int)nodes.size();
+    state.first.resize(nNodes);
+    state.count.resize(nNodes);
+    for (int i = nNodes - 1; i >= 0; --i) {
+        LinearBVHNode& node = nodes[i];
+        if (node.nPrimitives > 0) {
+            state.first[i] = node.primitivesOffset;
+            state.count[i] = node.nPrimitives;
+            Bounds3 leafBounds;
+            for (int j = 0; j < node.nPrimitives; ++j)
+                leafBounds = Union(leafBounds, (*state.bounds)[node.primitivesOffset + j]);
+            node.bounds = leafBounds;
+        }
+        else {
+            int right = node.secondChildOffset;
+            state.first[i] = state.first[i + 1];
+            state.count[i] = state.count[i + 1] + state.count[right];
+            node.bounds = Union(nodes[i + 1].bounds, nodes[right].bounds);
         }
+    }
+    subtreeCosts(state.cost);
+    state.rebuild.assign(nNodes, 0);
+    markRebuild(0, state, maxCostRatio);
+    bool rebuilt = std::find(state.rebuild.begin(), state.rebuild.end(), 1) != state.rebuild.end();
 
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + objects.size() * pos / bucketSize;
-        auto ending = objects.end();
+    //  BVHBuildNode  Sample , ΧкҲҪű, .
+    // ֻΧнû BVHBuildNode, ֻ refit ʱѾº
+    if (rebuilt || root) {
+        deleteBuildTree(root);
+        totalNodes = 0;
+        state.order.reserve(state.bounds->size());
+        root = unflatten(0, state);
+        nodes.resize(totalNodes);
+        int offset = 0;
+        flattenBVHTree(root, &offset);
 
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
+        // ûĽڵ㱣ԭĲο, ؽڵĴΪ׼
+        subtreeCosts(state.cost);
+        refCost.swap(state.newRefCost);
+        for (int i = 0; i < totalNodes; ++i) {
+            if (refCost[i] < 0)
+                refCost[i] = state.cost[i];
+        }
 
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+        if (!primitives.empty()) {
+            std::vector<Object*> orderedPrims(primitives.size());
+            for (size_t i = 0; i < primitives.size(); ++i)
+                orderedPrims[i] = primitives[state.order[i]];
+            primitives.swap(orderedPrims);
+        }
+        else {
+            primitiveOrder.swap(state.order);
+            deleteBuildTree(root);
+            root = nullptr;
+        }
+    }
 
-        node->left = recursiveBuildBySVH(leftshapes);
-        node->right = recursiveBuildBySVH(rightshapes);
+    //  BVH µĶºϲ
+    if (treeWidth == TreeWidth::BVH4) {
+        wideNodes4 = MappedArray<WideBVHNode<4>>();
+        collapseWide(0, wideNodes4);
+    }
+    else if (treeWidth == TreeWidth::BVH8) {
+        wideNodes8 = MappedArray<WideBVHNode<8>>();
+        collapseWide(0, wideNodes8);
+    }
+    return rebuilt;
+}
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
+// ÿ SAH ,  SAHCost һ, ڵıһ
+void BVHAccel::subtreeCosts(std::vector<float>& cost) const
+{
+    std::vector<double> sum(nodes.size());
+    cost.resize(nodes.size());
+    for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+        const LinearBVHNode& node = nodes[i];
+        double area = node.bounds.SurfaceArea();
+        if (node.nPrimitives > 0)
+            sum[i] = intersectionCost * node.nPrimitives * area;
+        else
+            sum[i] = traversalCost * area + sum[i + 1] + sum[node.secondChildOffset];
+        cost[i] = area > 0 ? (float)(sum[i] / area) : 0.0f;
+    }
+}
+
+// ˻ʼĵط: ǹ maxCostRatio Ӷû, ˵һĻֲٺ,
+// ؽΪ; Ҳ˻˾Ƚ, һ´ Update ٿ.
+// ҶӵĴֻͼԪй, ˻. ڵǷ˻
+bool BVHAccel::markRebuild(int nodeIndex, BVHUpdateState& state, float maxCostRatio) const
+{
+    const LinearBVHNode& node = nodes[nodeIndex];
+    if (node.nPrimitives > 0)
+        return false;
+    bool childDegraded = markRebuild(nodeIndex + 1, state, maxCostRatio);
+    childDegraded = markRebuild(node.secondChildOffset, state, maxCostRatio) || childDegraded;
+    bool degraded = state.cost[nodeIndex] > maxCostRatio * refCost[nodeIndex];
+    if (degraded && !childDegraded)
+        state.rebuild[nodeIndex] = 1;
+    return degraded;
+}
 
+// еת BVHBuildNode,  rebuild µİΧ½.
+//  flattenBVHTree һ,  newRefCost еĵ k ѹƽ k ڵ
+BVHBuildNode* BVHAccel::unflatten(int nodeIndex, BVHUpdateState& state)
+{
+    int first = state.first[nodeIndex], count = state.count[nodeIndex];
+    if (state.rebuild[nodeIndex]) {
+        std::vector<BVHPrimitiveInfo> primitiveInfo(count);
+        for (int i = 0; i < count; ++i)
+            primitiveInfo[i] = BVHPrimitiveInfo(first + i, (*state.bounds)[first + i]);
+        int before = totalNodes;
+        BVHBuildNode* node = recursiveBuild(primitiveInfo, 0, count, state.order);
+        state.newRefCost.insert(state.newRefCost.end(), totalNodes - before, -1.0f);
+        return node;
     }
 
+    const LinearBVHNode& linearNode = nodes[nodeIndex];
+    BVHBuildNode* node = new BVHBuildNode();
+    ++totalNodes;
+    node->bounds = linearNode.bounds;
+    state.newRefCost.push_back(refCost[nodeIndex]);
+    if (linearNode.nPrimitives > 0) {
+        node->firstPrimOffset = (int)state.order.size();
+        node->nPrimitives = linearNode.nPrimitives;
+        node->area = 0;
+        for (int i = first; i < first + count; ++i) {
+            state.order.push_back(i);
+            if (!primitives.empty())
+                node->area += primitives[i]->getArea();
+        }
+    }
+    else {
+        node->splitAxis = linearNode.axis;
+        node->left = unflatten(nodeIndex + 1, state);
+        node->right = unflatten(linearNode.secondChildOffset, state);
+        node->area = node->left->area + node->right->area;
+    }
     return node;
 }
 
+BVHAccel::~BVHAccel()
+{
+    deleteBuildTree(root);
+}
+
+void BVHAccel::deleteBuildTree(BVHBuildNode* node)
+{
+    if (!node)
+        return;
+    deleteBuildTree(node->left);
+    deleteBuildTree(node->right);
+    delete node;
+}
+
+Bounds3 BVHAccel::WorldBound() const
+{
+    return nodes.empty() ? Bounds3() : nodes[0].bounds;
+}
+
+int BVHAccel::flattenBVHTree(BVHBuildNode* node, int* offset)
+{
+    LinearBVHNode& linearNode = nodes[*offset];
+    linearNode.bounds = node->bounds;
+    int myOffset = (*offset)++;
+    if (node->nPrimitives > 0) {
+        // Ҷӽڵ
+        linearNode.primitivesOffset = node->firstPrimOffset;
+        linearNode.nPrimitives = (uint16_t)node->nPrimitives;
+    }
+    else {
+        // ڲڵ, ӽں
+        linearNode.axis = (uint8_t)node->splitAxis;
+        linearNode.nPrimitives = 0;
+        flattenBVHTree(node->left, offset);
+        nodes[myOffset].secondChildOffset = flattenBVHTree(node->right, offset);
+    }
+    return myOffset;
+}
+
+//  nodeIndex ΪĶϲ N ڵ: ѱڲ
+// 滻, ֱ N ֻʣҶ. ½ڵ wideNodes е±.
+template <int N>
+int BVHAccel::collapseWide(int nodeIndex, MappedArray<WideBVHNode<N>>& wideNodes) const
+{
+    int children[N];
+    int nChildren = 0;
+    if (nodes[nodeIndex].nPrimitives > 0) {
+        // ֻһҶ
+        children[nChildren++] = nodeIndex;
+    }
+    else {
+        children[nChildren++] = nodeIndex + 1;
+        children[nChildren++] = nodes[nodeIndex].secondChildOffset;
+    }
+    while (nChildren < N) {
+        int best = -1;
+        double bestArea = -1;
+        for (int i = 0; i < nChildren; ++i) {
+            const LinearBVHNode& child = nodes[children[i]];
+            if (child.nPrimitives == 0 && child.bounds.SurfaceArea() > bestArea) {
+                best = i;
+                bestArea = child.bounds.SurfaceArea();
+            }
+        }
+        if (best < 0)
+            break;
+        int expand = children[best];
+        children[best] = expand + 1;
+        children[nChildren++] = nodes[expand].secondChildOffset;
+    }
+
+    WideBVHNode<N> wide;
+    for (int i = 0; i < N; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            wide.bounds[axis][i] = kInfinity;
+            wide.bounds[axis + 3][i] = -kInfinity;
+        }
+        wide.child[i] = -1;
+        wide.nPrimitives[i] = 0;
+    }
+
+    int wideIndex = (int)wideNodes.size();
+    wideNodes.push_back(wide);
+    for (int i = 0; i < nChildren; ++i) {
+        const LinearBVHNode& child = nodes[children[i]];
+        for (int axis = 0; axis < 3; ++axis) {
+            wide.bounds[axis][i] = child.bounds.pMin[axis];
+            wide.bounds[axis + 3][i] = child.bounds.pMax[axis];
+        }
+        if (child.nPrimitives > 0) {
+            wide.child[i] = child.primitivesOffset;
+            wide.nPrimitives[i] = child.nPrimitives;
+        }
+        else {
+            wide.child[i] = collapseWide(children[i], wideNodes);
+        }
+    }
+    wideNodes[wideIndex] = wide;
+    return wideIndex;
+}
 
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
+    if (treeWidth == TreeWidth::BVH4)
+        return intersectWide4(ray);
+    if (treeWidth == TreeWidth::BVH8)
+        return intersectWide8(ray);
+
     Intersection isect;
-    if (!root)
+    if (nodes.empty())
         return isect;
-    isect = BVHAccel::getIntersection(root, ray);
+
+    // ( MeshTriangle Լ BVH)Ҳ t_max ޳ԶĽڵ
+    float tMax = (float)std::min(ray.t_max, (double)kInfinity);
+    HitRecord hit;
+    intersectSubtree(ray, 0, tMax, hit, isect);
+    if (hit.index >= 0)
+        leafIntersector->ComputeIntersection(ray, hit, isect);
     return isect;
 }
 
-Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
+//  nodeIndex ʼ, ҵ tMax Ľʱ tMax.
+// Ҷӽ leafIntersector ʱֻ hit, ɵȫ isect; ֱӸ isect
+void BVHAccel::intersectSubtree(const Ray& ray, int nodeIndex, float& tMax, HitRecord& hit,
+                                Intersection& isect) const
 {
-    // TODO Traverse the BVH to find intersection
-    // ߲Χཻ
-    std::array<int, 3> dirIsNeg = { ray.direction.x > 0,ray.direction.y > 0 ,ray.direction.z > 0 };
-    if (!node || !node->bounds.IntersectP(ray, Vector3f::Reciprocal(ray.direction), dirIsNeg)) {
-        return Intersection();
+    Ray r = ray;
+    const Vector3f& invDir = ray.direction_inv;
+    std::array<int, 3> dirIsNeg = { ray.direction.x > 0, ray.direction.y > 0, ray.direction.z > 0 };
+
+    // ջݹ, ȷĺ
+    int toVisitOffset = 0, currentNodeIndex = nodeIndex;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode* node = &nodes[currentNodeIndex];
+        STAT_ADD(kStatNodesVisited, 1);
+        STAT_ADD(kStatBoxTests, 1);
+        if (node->bounds.IntersectP(ray, invDir, dirIsNeg, tMax)) {
+            if (node->nPrimitives > 0) {
+                // Ҷӽڵ, ֻȵǰĽ
+                if (leafIntersector) {
+                    leafIntersector->IntersectLeaf(ray, node->primitivesOffset, node->nPrimitives, tMax, hit);
+                }
+                else {
+                    for (int i = 0; i < node->nPrimitives; ++i) {
+                        r.t_max = tMax;
+                        Intersection objectHit = primitives[node->primitivesOffset + i]->getIntersection(r);
+                        if (objectHit.happened && objectHit.distance < tMax) {
+                            isect = objectHit;
+                            tMax = (float)objectHit.distance;
+                        }
+                    }
+                }
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else {
+                // dirIsNeg[axis] Ϊ 1 ʾظ, (Сһ)
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                else {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+            }
+        }
+        else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
     }
-    // Ϊӽڵ
-    if (!node->left && !node->right) {
-        Intersection hit = node->object->getIntersection(ray);
-        return hit;
+}
+
+// ڵѯ: ֻҪ [0, ray.t_max) ͷ, ҪĽ,
+// Ҳù Intersection
+bool BVHAccel::IntersectP(const Ray& ray) const
+{
+    if (treeWidth == TreeWidth::BVH4)
+        return intersectPWide4(ray);
+    if (treeWidth == TreeWidth::BVH8)
+        return intersectPWide8(ray);
+
+    if (nodes.empty())
+        return false;
+
+    return intersectPSubtree(ray, 0, (float)std::min(ray.t_max, (double)kInfinity));
+}
+
+bool BVHAccel::intersectPSubtree(const Ray& ray, int nodeIndex, float tMax) const
+{
+    const Vector3f& invDir = ray.direction_inv;
+    std::array<int, 3> dirIsNeg = { ray.direction.x > 0, ray.direction.y > 0, ray.direction.z > 0 };
+
+    int toVisitOffset = 0, currentNodeIndex = nodeIndex;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode* node = &nodes[currentNodeIndex];
+        STAT_ADD(kStatNodesVisited, 1);
+        STAT_ADD(kStatBoxTests, 1);
+        if (node->bounds.IntersectP(ray, invDir, dirIsNeg, tMax)) {
+            if (node->nPrimitives > 0) {
+                if (leafIntersector) {
+                    if (leafIntersector->IntersectLeafP(ray, node->primitivesOffset, node->nPrimitives, tMax))
+                        return true;
+                }
+                else {
+                    for (int i = 0; i < node->nPrimitives; ++i) {
+                        if (primitives[node->primitivesOffset + i]->intersect(ray))
+                            return true;
+                    }
+                }
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                else {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+            }
+        }
+        else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+// ߰õ SoA . ĹÿϷŶͬʱ, ԰
+// , һжǷΧ (Wald 2007  IA ޳)
+struct RayPacketData {
+    int count;
+    uint32_t activeMask;
+    float origin[3][kMaxPacketSize];
+    float invDir[3][kMaxPacketSize];
+    float tMax[kMaxPacketSize];
+    float maxT;                     // ʼ tMax ֵ, ʱ㹻
+    float originMin[3], originMax[3], invDirMin[3], invDirMax[3];
+    std::array<int, 3> dirIsNeg;    // ͵һ, 1 ʾظ
+
+    // ذǷ㹻һ (йߵķͬûзΪ 0)
+    bool Init(const Ray* rays, int count, uint32_t mask)
+    {
+        this->count = count;
+        activeMask = mask;
+        maxT = 0;
+        int first = -1;
+        for (int i = 0; i < count; ++i) {
+            if (!(mask & (1u << i)))
+                continue;
+            if (first < 0)
+                first = i;
+            maxT = std::max(maxT, tMax[i]);
+            for (int axis = 0; axis < 3; ++axis) {
+                origin[axis][i] = rays[i].origin[axis];
+                invDir[axis][i] = rays[i].direction_inv[axis];
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            dirIsNeg[axis] = rays[first].direction[axis] > 0;
+            originMin[axis] = invDirMin[axis] = kInfinity;
+            originMax[axis] = invDirMax[axis] = -kInfinity;
+            for (int i = 0; i < count; ++i) {
+                if (!(mask & (1u << i)))
+                    continue;
+                float d = rays[i].direction[axis];
+                if (d == 0 || (d > 0) != (dirIsNeg[axis] == 1))
+                    return false;
+                originMin[axis] = std::min(originMin[axis], origin[axis][i]);
+                originMax[axis] = std::max(originMax[axis], origin[axis][i]);
+                invDirMin[axis] = std::min(invDirMin[axis], invDir[axis][i]);
+                invDirMax[axis] = std::max(invDirMax[axis], invDir[axis][i]);
+            }
+        }
+        return true;
+    }
+
+    // ıز:  false ʱκһ߶Χཻ
+    bool IntervalTest(const Bounds3& bounds) const
+    {
+        STAT_ADD(kStatBoxTests, 1);
+        float tEnter = 0, tExit = maxT;
+        for (int axis = 0; axis < 3; ++axis) {
+            float nearPlane = dirIsNeg[axis] ? bounds.pMin[axis] : bounds.pMax[axis];
+            float farPlane = dirIsNeg[axis] ? bounds.pMax[axis] : bounds.pMin[axis];
+            // t = (plane - o) * invDir Ķ˵㴦ȡֵ
+            float n0 = nearPlane - originMin[axis], n1 = nearPlane - originMax[axis];
+            float f0 = farPlane - originMin[axis], f1 = farPlane - originMax[axis];
+            float lo = std::min(std::min(n0 * invDirMin[axis], n0 * invDirMax[axis]),
+                                std::min(n1 * invDirMin[axis], n1 * invDirMax[axis]));
+            float hi = std::max(std::max(f0 * invDirMin[axis], f0 * invDirMax[axis]),
+                                std::max(f1 * invDirMin[axis], f1 * invDirMax[axis]));
+            tEnter = std::max(tEnter, lo);
+            tExit = std::min(tExit, hi);
+        }
+        return tEnter <= tExit;
+    }
+
+    // ߵ slab test
+    bool TestRay(const Bounds3& bounds, int i) const
+    {
+        STAT_ADD(kStatBoxTests, 1);
+        float tEnter = 0, tExit = tMax[i];
+        for (int axis = 0; axis < 3; ++axis) {
+            float nearPlane = dirIsNeg[axis] ? bounds.pMin[axis] : bounds.pMax[axis];
+            float farPlane = dirIsNeg[axis] ? bounds.pMax[axis] : bounds.pMin[axis];
+            tEnter = std::max(tEnter, (nearPlane - origin[axis][i]) * invDir[axis][i]);
+            tExit = std::min(tExit, (farPlane - origin[axis][i]) * invDir[axis][i]);
+        }
+        return tEnter <= tExit;
+    }
+
+    //  first ʼҵһΧཻĻ, ûʱ count.
+    // ڲڵֻҪһо, ڵֻҪһ.
+    int FirstHit(const Bounds3& bounds, int first, uint32_t skip) const
+    {
+        for (int i = first; i < count; ++i) {
+            if ((activeMask & ~skip & (1u << i)) && TestRay(bounds, i))
+                return i;
+        }
+        return count;
+    }
+
+    // ҶӴ, ش first ʼΧཻĹ
+    uint32_t LeafMask(const Bounds3& bounds, int first, uint32_t skip) const
+    {
+        uint32_t mask = 0;
+        for (int i = first; i < count; ++i) {
+            if ((activeMask & ~skip & (1u << i)) && TestRay(bounds, i))
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+};
+
+void BVHAccel::IntersectPacket(const Ray* rays, int count, uint32_t activeMask, Intersection* hits) const
+{
+    if (nodes.empty() || !activeMask)
+        return;
+
+    RayPacketData packet;
+    // Ҷӽ leafIntersector ʱÿֻͼԪ, ٲȫ hits
+    HitRecord leafHits[kMaxPacketSize];
+    for (int i = 0; i < count; ++i)
+        packet.tMax[i] = (float)std::min({ rays[i].t_max, hits[i].distance, (double)kInfinity });
+    if (!packet.Init(rays, count, activeMask)) {
+        // һµİû޳, ˻
+        for (int i = 0; i < count; ++i) {
+            if (!(activeMask & (1u << i)))
+                continue;
+            Ray r = rays[i];
+            r.t_max = packet.tMax[i];
+            Intersection hit = Intersect(r);
+            if (hit.happened && hit.distance < hits[i].distance)
+                hits[i] = hit;
+        }
+        return;
     }
-    // 
-    Intersection hit1 = getIntersection(node->left, ray);
-    Intersection hit2 = getIntersection(node->right, ray);
 
-    // ĵ
-    return hit1.distance < hit2.distance ? hit1 : hit2;
+    // ջ¼ڵ͵һеĹ
+    struct StackEntry {
+        int node;
+        int first;
+    };
+    StackEntry stack[64];
+    int stackSize = 0;
+    StackEntry current = { 0, 0 };
+    while (true) {
+        const LinearBVHNode& node = nodes[current.node];
+        STAT_ADD(kStatNodesVisited, 1);
+        int first = packet.IntervalTest(node.bounds) ? packet.FirstHit(node.bounds, current.first, 0) : count;
+        if (first < count && (activeMask >> first) == 1u) {
+            // ֻʣһ, Ѿûкô, ˻ص
+            intersectSubtree(rays[first], current.node, packet.tMax[first], leafHits[first], hits[first]);
+            first = count;
+        }
+        if (first < count && node.nPrimitives == 0) {
+            // ߵķͬ, Զ˳͵һ
+            int nearChild = current.node + 1, farChild = node.secondChildOffset;
+            if (!packet.dirIsNeg[node.axis])
+                std::swap(nearChild, farChild);
+            stack[stackSize++] = { farChild, first };
+            current = { nearChild, first };
+            continue;
+        }
+        if (first < count) {
+            uint32_t mask = packet.LeafMask(node.bounds, first, 0);
+            if (leafIntersector) {
+                for (int i = first; i < count; ++i) {
+                    if (mask & (1u << i))
+                        leafIntersector->IntersectLeaf(rays[i], node.primitivesOffset, node.nPrimitives,
+                                                       packet.tMax[i], leafHits[i]);
+                }
+            }
+            else {
+                //  BVH , ѰԼ BVH
+                for (int p = 0; p < node.nPrimitives; ++p)
+                    primitives[node.primitivesOffset + p]->getIntersectionPacket(rays, count, mask, hits);
+                for (int i = first; i < count; ++i) {
+                    if (mask & (1u << i))
+                        packet.tMax[i] = std::min(packet.tMax[i], (float)hits[i].distance);
+                }
+            }
+        }
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+    for (int i = 0; i < count; ++i) {
+        if (leafHits[i].index >= 0)
+            leafIntersector->ComputeIntersection(rays[i], leafHits[i], hits[i]);
+    }
 }
 
-void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
+uint32_t BVHAccel::IntersectPPacket(const Ray* rays, int count, uint32_t activeMask) const
+{
+    if (nodes.empty() || !activeMask)
+        return 0;
+
+    RayPacketData packet;
+    for (int i = 0; i < count; ++i)
+        packet.tMax[i] = (float)std::min(rays[i].t_max, (double)kInfinity);
+    uint32_t occluded = 0;
+    if (!packet.Init(rays, count, activeMask)) {
+        for (int i = 0; i < count; ++i) {
+            if ((activeMask & (1u << i)) && IntersectP(rays[i]))
+                occluded |= 1u << i;
+        }
+        return occluded;
+    }
+
+    struct StackEntry {
+        int node;
+        int first;
+    };
+    StackEntry stack[64];
+    int stackSize = 0;
+    StackEntry current = { 0, 0 };
+    while (true) {
+        const LinearBVHNode& node = nodes[current.node];
+        STAT_ADD(kStatNodesVisited, 1);
+        // ѾȷסĹ߲
+        int first = packet.IntervalTest(node.bounds)
+                  ? packet.FirstHit(node.bounds, current.first, occluded) : count;
+        if (first < count && ((activeMask & ~occluded) >> first) == 1u) {
+            if (intersectPSubtree(rays[first], current.node, packet.tMax[first]))
+                occluded |= 1u << first;
+            first = count;
+        }
+        if (first < count && node.nPrimitives == 0) {
+            int nearChild = current.node + 1, farChild = node.secondChildOffset;
+            if (!packet.dirIsNeg[node.axis])
+                std::swap(nearChild, farChild);
+            stack[stackSize++] = { farChild, first };
+            current = { nearChild, first };
+            continue;
+        }
+        if (first < count) {
+            uint32_t mask = packet.LeafMask(node.bounds, first, occluded);
+            if (leafIntersector) {
+                for (int i = first; i < count; ++i) {
+                    if ((mask & (1u << i))
+                        && leafIntersector->IntersectLeafP(rays[i], node.primitivesOffset, node.nPrimitives,
+                                                           packet.tMax[i]))
+                        occluded |= 1u << i;
+                }
+            }
+            else {
+                for (int p = 0; p < node.nPrimitives && (mask & ~occluded); ++p)
+                    occluded |= primitives[node.primitivesOffset + p]->intersectPacketP(rays, count, mask & ~occluded);
+            }
+            if (occluded == activeMask)
+                break;
+        }
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+    return occluded;
+}
+
+void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, Sampler &sampler){
     if(node->left == nullptr || node->right == nullptr){
-        node->object->Sample(pos, pdf);
-        pdf *= node->area;
+        // Ҷﰴһ
+        Object* object = primitives[node->firstPrimOffset];
+        for (int i = 0; i < node->nPrimitives; ++i) {
+            object = primitives[node->firstPrimOffset + i];
+            if (p < object->getArea())
+                break;
+            p -= object->getArea();
+        }
+        object->Sample(pos, pdf, sampler);
+        pdf *= object->getArea();
         return;
     }
-    if(p < node->left->area) getSample(node->left, p, pos, pdf);
-    else getSample(node->right, p - node->left->area, pos, pdf);
+    if(p < node->left->area) getSample(node->left, p, pos, pdf, sampler);
+    else getSample(node->right, p - node->left->area, pos, pdf, sampler);
 }
 
-void BVHAccel::Sample(Intersection &pos, float &pdf){
-    float p = std::sqrt(get_random_float()) * root->area;
-    getSample(root, p, pos, pdf);
+void BVHAccel::Sample(Intersection &pos, float &pdf, Sampler &sampler){
+    float p = sampler.Get1D() * root->area;
+    getSample(root, p, pos, pdf, sampler);
     pdf /= root->area;
 }
\ No newline at end of file
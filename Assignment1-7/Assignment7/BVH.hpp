@@ -8,53 +8,165 @@
 #include <atomic>
 #include <vector>
 #include <memory>
-#include <ctime>
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Vector.hpp"
+#include "MappedFile.hpp"
+#include "Stats.hpp"
 
 struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
+struct MortonPrimitive;
+struct BVHUpdateState;
+
+// 建树完成后把树按深度优先顺序压平成连续数组, 一个节点正好 32 字节.
+// 内部节点的左孩子紧跟在自己后面, 右孩子的位置记在 secondChildOffset;
+// 叶子节点引用 primitives 中 [primitivesOffset, primitivesOffset + nPrimitives) 的物体.
+struct alignas(32) LinearBVHNode {
+    Bounds3 bounds;
+    union {
+        int primitivesOffset;   // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nPrimitives;       // 0 -> interior node
+    uint8_t axis;               // interior node: split axis
+    uint8_t pad[1];
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fill one half cache line");
+
+// 由二叉树合并而来的 N 叉节点. 孩子的包围盒按 SoA 存放, 同一轴同一侧的 N 个值连续,
+// 一条光线用一次 SIMD slab test 就能测完所有孩子.
+// 叶子孩子直接引用 primitives 中的区间, 空槽的包围盒是反的(min > max), 永远不会命中.
+template <int N>
+struct alignas(N * 4) WideBVHNode {
+    float bounds[6][N];         // minX, minY, minZ, maxX, maxY, maxZ
+    int child[N];               // interior: 子节点下标, leaf: primitivesOffset, 空槽: -1
+    uint16_t nPrimitives[N];    // 0 -> interior child
+};
+
+// 叶子中的物体可以交给所有者批量求交, 比如 MeshTriangle 把叶子里的三角形
+// 打包成 SoA 块做 SIMD 测试. 两个函数处理 primitives 中 [first, first + count) 的物体.
+class BVHLeafIntersector {
+public:
+    virtual ~BVHLeafIntersector() = default;
+    // 找到比 tMax 更近的交点时更新 tMax 和 hit 并返回 true
+    virtual bool IntersectLeaf(const Ray& ray, int first, int count, float& tMax,
+                               HitRecord& hit) const = 0;
+    virtual bool IntersectLeafP(const Ray& ray, int first, int count, float tMax) const = 0;
+    // 遍历结束后只对最近的交点调用一次, 由 hit 填好 isect
+    virtual void ComputeIntersection(const Ray& ray, const HitRecord& hit, Intersection& isect) const = 0;
+};
+
+// 一个光线包最多 16 条光线 (4x4 像素)
+constexpr int kMaxPacketSize = 16;
+
+// 运行时检测 CPU 是否支持宽 BVH 需要的指令集 (BVHWide.cpp)
+bool CpuSupportsSSE();
+bool CpuSupportsAVX2();
 
 // BVHAccel Declarations
-inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
 class BVHAccel {
 
 public:
     // BVHAccel Public Types
-    enum class SplitMethod { NAIVE, SAH };
+    // HLBVH 用 Morton 码并行建树, 比 SAH 快得多但树稍差, 适合预览和很大的网格.
+    // HLBVH 树的 Update 局部重建时按 SAH 建
+    enum class SplitMethod { NAIVE, SAH, HLBVH };
+    // BINARY 用标量遍历, BVH4 需要 SSE, BVH8 需要 AVX2; CPU 不支持时会自动退回更窄的树
+    enum class TreeWidth { BINARY = 2, BVH4 = 4, BVH8 = 8 };
 
     // BVHAccel Public Methods
-    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
+    BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE,
+             TreeWidth treeWidth = TreeWidth::BINARY);
+    // 只按图元的包围盒建树, 不需要 Object. primitives 为空, 叶子必须交给 leafIntersector,
+    // 叶子中的第 i 个图元是 bounds[primitiveOrder[i]]. 不能调用 Sample
+    BVHAccel(const std::vector<Bounds3>& bounds, int maxPrimsInNode, SplitMethod splitMethod,
+             TreeWidth treeWidth);
+    // 直接使用已经建好的树 (比如网格缓存里读出的), p 已经按叶子的顺序排好.
+    // 没有建树用的 BVHBuildNode, 不能调用 Sample
+    BVHAccel(std::vector<Object*> p, MappedArray<LinearBVHNode> nodes, MappedArray<WideBVHNode<4>> wideNodes4,
+             MappedArray<WideBVHNode<8>> wideNodes8, int maxPrimsInNode, SplitMethod splitMethod,
+             TreeWidth treeWidth);
+    // 当前 CPU 能用的树宽, 不支持需要的指令集时退回更窄的树
+    static TreeWidth SupportedWidth(TreeWidth treeWidth);
     Bounds3 WorldBound() const;
     ~BVHAccel();
 
     Intersection Intersect(const Ray &ray) const;
-    Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    // 光线包遍历, 语义与 Object::getIntersectionPacket / intersectPacketP 相同
+    void IntersectPacket(const Ray* rays, int count, uint32_t activeMask, Intersection* hits) const;
+    uint32_t IntersectPPacket(const Ray* rays, int count, uint32_t activeMask) const;
+    BVHBuildNode* root = nullptr;
+
+    double SAHCost() const;
+
+    // 图元移动或变形之后更新树. bounds 按叶子的顺序给出 (第 i 个是叶子中第 i 个图元的包围盒),
+    // 为空时用 primitives 的 getBounds. 先自底向上重算节点的包围盒 (refit), 某棵子树的 SAH 代价
+    // 比建树时涨了 maxCostRatio 倍以上, 就从退化开始的那一层起按新的包围盒重建这棵子树.
+    // 重建只在子树自己的图元区间内调换顺序; 物体树直接重排 primitives, 只按包围盒建的树
+    // 把新顺序留在 primitiveOrder 里 (第 i 个是更新前叶子中的第几个), 由调用者重排自己的图元.
+    // 返回是否有子树重建过
+    bool Update(const std::vector<Bounds3>& bounds = std::vector<Bounds3>(), float maxCostRatio = 1.5f);
 
     // BVHAccel Private Methods
-    BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
-    BVHBuildNode* recursiveBuildBySVH(std::vector<Object*> objects);
+    void build(const std::vector<Bounds3>& bounds);
+    BVHBuildNode* recursiveBuild(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                                 std::vector<int>& order);
+    BVHBuildNode* createLeaf(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                             const Bounds3& bounds, std::vector<int>& order);
+    int partitionSAH(std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+                     const Bounds3& bounds, const Bounds3& centroidBounds, int dim);
+    BVHBuildNode* hlbvhBuild(std::vector<BVHPrimitiveInfo>& primitiveInfo, std::vector<int>& order);
+    BVHBuildNode* emitLBVH(const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+                           const std::vector<MortonPrimitive>& mortonPrims, int start, int n, int bitIndex,
+                           int& nodeCount) const;
+    BVHBuildNode* buildUpperSAH(std::vector<BVHPrimitiveInfo>& treeletInfo, int start, int end,
+                                const std::vector<BVHBuildNode*>& roots);
+    void renumberLeaves(BVHBuildNode* node, const std::vector<MortonPrimitive>& mortonPrims,
+                        const std::vector<BVHPrimitiveInfo>& primitiveInfo, std::vector<int>& order) const;
+    int flattenBVHTree(BVHBuildNode* node, int* offset);
+    void subtreeCosts(std::vector<float>& cost) const;
+    bool markRebuild(int nodeIndex, BVHUpdateState& state, float maxCostRatio) const;
+    BVHBuildNode* unflatten(int nodeIndex, BVHUpdateState& state);
+    void intersectSubtree(const Ray& ray, int nodeIndex, float& tMax, HitRecord& hit, Intersection& isect) const;
+    bool intersectPSubtree(const Ray& ray, int nodeIndex, float tMax) const;
+    template <int N>
+    int collapseWide(int nodeIndex, MappedArray<WideBVHNode<N>>& wideNodes) const;
+    Intersection intersectWide4(const Ray& ray) const;
+    Intersection intersectWide8(const Ray& ray) const;
+    bool intersectPWide4(const Ray& ray) const;
+    bool intersectPWide8(const Ray& ray) const;
+    void deleteBuildTree(BVHBuildNode* node);
 
     // BVHAccel Private Data
+    // SAH 中一次包围盒遍历和一次物体求交的相对代价
+    static constexpr double traversalCost = 1.0;
+    static constexpr double intersectionCost = 1.0;
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<Object*> primitives;
-
-    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
-    void Sample(Intersection &pos, float &pdf);
+    std::vector<int> primitiveOrder;    // 只按包围盒建树时有效
+    std::vector<float> refCost;         // 建树时各子树的 SAH 代价, 第一次 Update 时才算
+    MappedArray<LinearBVHNode> nodes;
+    int totalNodes = 0;
+    TreeWidth treeWidth;
+    MappedArray<WideBVHNode<4>> wideNodes4;
+    MappedArray<WideBVHNode<8>> wideNodes8;
+    // 不为空时叶子交给它求交, 否则逐个调用物体的 getIntersection / intersect
+    const BVHLeafIntersector* leafIntersector = nullptr;
+
+    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, Sampler &sampler);
+    void Sample(Intersection &pos, float &pdf, Sampler &sampler);
 };
 
 struct BVHBuildNode {
     Bounds3 bounds;
     BVHBuildNode *left;
     BVHBuildNode *right;
-    Object* object;
     float area;
 
 public:
@@ -63,7 +175,6 @@ public:
     BVHBuildNode(){
         bounds = Bounds3();
         left = nullptr;right = nullptr;
-        object = nullptr;
     }
 };
 
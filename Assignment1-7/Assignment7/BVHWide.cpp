@@ -0,0 +1,165 @@
+//
+// SIMD traversal of the 4-wide and 8-wide BVH.
+//
+
+#include <algorithm>
+#include "BVH.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BVH_WIDE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef BVH_WIDE_X86
+
+bool CpuSupportsSSE()
+{
+    // x86-64 至少有 SSE2
+    return true;
+}
+
+bool CpuSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // OSXSAVE + AVX, 并且操作系统保存了 YMM 寄存器
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// 光线方向为负的轴上, 近平面是 max, 远平面是 min
+namespace wide4 {
+
+constexpr int N = 4;
+
+struct RayData {
+    explicit RayData(const Ray& ray)
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            origin[axis] = _mm_set1_ps(ray.origin[axis]);
+            invDir[axis] = _mm_set1_ps(ray.direction_inv[axis]);
+            nearIndex[axis] = ray.direction[axis] > 0 ? axis : axis + 3;
+            farIndex[axis] = ray.direction[axis] > 0 ? axis + 3 : axis;
+        }
+    }
+    __m128 origin[3], invDir[3];
+    int nearIndex[3], farIndex[3];
+};
+
+inline int TestChildren(const WideBVHNode<N>& node, const RayData& ray, float tMax, float* tEnter)
+{
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar = _mm_set1_ps(tMax);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.nearIndex[axis]]), ray.origin[axis]),
+                               ray.invDir[axis]);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.farIndex[axis]]), ray.origin[axis]),
+                               ray.invDir[axis]);
+        // 操作数为 NaN 时 max/min 返回第二个参数, 光线贴着平面时忽略这个轴
+        tNear = _mm_max_ps(t0, tNear);
+        tFar = _mm_min_ps(t1, tFar);
+    }
+    _mm_store_ps(tEnter, tNear);
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+#include "BVHWide.inl"
+
+} // namespace wide4
+
+// 8 宽的部分用 AVX2 编译, 只有运行时检测通过才会被调用
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define BVH_WIDE_POP_OPTIONS
+#endif
+
+namespace wide8 {
+
+constexpr int N = 8;
+
+struct RayData {
+    explicit RayData(const Ray& ray)
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            origin[axis] = _mm256_set1_ps(ray.origin[axis]);
+            invDir[axis] = _mm256_set1_ps(ray.direction_inv[axis]);
+            nearIndex[axis] = ray.direction[axis] > 0 ? axis : axis + 3;
+            farIndex[axis] = ray.direction[axis] > 0 ? axis + 3 : axis;
+        }
+    }
+    __m256 origin[3], invDir[3];
+    int nearIndex[3], farIndex[3];
+};
+
+inline int TestChildren(const WideBVHNode<N>& node, const RayData& ray, float tMax, float* tEnter)
+{
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar = _mm256_set1_ps(tMax);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearIndex[axis]]),
+                                                ray.origin[axis]), ray.invDir[axis]);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.farIndex[axis]]),
+                                                ray.origin[axis]), ray.invDir[axis]);
+        tNear = _mm256_max_ps(t0, tNear);
+        tFar = _mm256_min_ps(t1, tFar);
+    }
+    _mm256_store_ps(tEnter, tNear);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+
+#include "BVHWide.inl"
+
+} // namespace wide8
+
+Intersection BVHAccel::intersectWide8(const Ray& ray) const
+{
+    return wide8::Intersect(wideNodes8, primitives, leafIntersector, ray);
+}
+
+bool BVHAccel::intersectPWide8(const Ray& ray) const
+{
+    return wide8::IntersectP(wideNodes8, primitives, leafIntersector, ray);
+}
+
+#ifdef BVH_WIDE_POP_OPTIONS
+#pragma GCC pop_options
+#undef BVH_WIDE_POP_OPTIONS
+#endif
+
+Intersection BVHAccel::intersectWide4(const Ray& ray) const
+{
+    return wide4::Intersect(wideNodes4, primitives, leafIntersector, ray);
+}
+
+bool BVHAccel::intersectPWide4(const Ray& ray) const
+{
+    return wide4::IntersectP(wideNodes4, primitives, leafIntersector, ray);
+}
+
+#else
+
+// 非 x86 平台没有宽 BVH, 构造函数会退回二叉树, 这些函数不会被调用
+bool CpuSupportsSSE() { return false; }
+bool CpuSupportsAVX2() { return false; }
+
+Intersection BVHAccel::intersectWide4(const Ray& ray) const { return Intersection(); }
+Intersection BVHAccel::intersectWide8(const Ray& ray) const { return Intersection(); }
+bool BVHAccel::intersectPWide4(const Ray& ray) const { return false; }
+bool BVHAccel::intersectPWide8(const Ray& ray) const { return false; }
+
+#endif
@@ -0,0 +1,126 @@
+//
+// Wide BVH traversal shared by the 4-wide (SSE) and 8-wide (AVX2) trees.
+// BVHWide.cpp includes this file once per width, inside a namespace that defines
+// N, RayData and TestChildren(node, rayData, tMax, tEnter) -> hit mask.
+//
+
+// 命中的孩子按 tEnter 从近到远排序, N 最多为 8, 插入排序就够了
+inline int SortHitChildren(int mask, const float* tEnter, int* order)
+{
+    int count = 0;
+    for (int i = 0; i < N; ++i) {
+        if (!(mask & (1 << i)))
+            continue;
+        int j = count++;
+        while (j > 0 && tEnter[order[j - 1]] > tEnter[i]) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = i;
+    }
+    return count;
+}
+
+struct StackEntry {
+    int node;
+    float tEnter;
+};
+
+Intersection Intersect(const MappedArray<WideBVHNode<N>>& nodes, const std::vector<Object*>& primitives,
+                       const BVHLeafIntersector* leafIntersector, const Ray& ray)
+{
+    Intersection isect;
+    if (nodes.empty())
+        return isect;
+
+    Ray r = ray;
+    float tMax = (float)std::min(ray.t_max, (double)kInfinity);
+    RayData rayData(ray);
+    // 网格的叶子只记下最近的三角形, 遍历完再补全 isect
+    HitRecord hit;
+
+    // 每层最多压入 N - 1 个孩子
+    StackEntry stack[64 * (N - 1)];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0.0f };
+    alignas(32) float tEnter[N];
+    int order[N];
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        // 压栈之后找到了更近的交点, 这个节点已经不可能更近
+        if (entry.tEnter > tMax)
+            continue;
+        const WideBVHNode<N>& node = nodes[entry.node];
+        STAT_ADD(kStatNodesVisited, 1);
+        STAT_ADD(kStatBoxTests, N);
+        int hitCount = SortHitChildren(TestChildren(node, rayData, tMax, tEnter), tEnter, order);
+
+        // 叶子孩子从近到远直接求交, 内部孩子从远到近压栈, 这样最近的先出栈
+        for (int k = 0; k < hitCount; ++k) {
+            int i = order[k];
+            if (node.nPrimitives[i] == 0 || tEnter[i] > tMax)
+                continue;
+            if (leafIntersector) {
+                leafIntersector->IntersectLeaf(ray, node.child[i], node.nPrimitives[i], tMax, hit);
+                continue;
+            }
+            for (int p = 0; p < node.nPrimitives[i]; ++p) {
+                r.t_max = tMax;
+                Intersection objectHit = primitives[node.child[i] + p]->getIntersection(r);
+                if (objectHit.happened && objectHit.distance < tMax) {
+                    isect = objectHit;
+                    tMax = (float)objectHit.distance;
+                }
+            }
+        }
+        for (int k = hitCount - 1; k >= 0; --k) {
+            int i = order[k];
+            if (node.nPrimitives[i] == 0 && tEnter[i] <= tMax)
+                stack[stackSize++] = { node.child[i], tEnter[i] };
+        }
+    }
+    if (hit.index >= 0)
+        leafIntersector->ComputeIntersection(ray, hit, isect);
+    return isect;
+}
+
+bool IntersectP(const MappedArray<WideBVHNode<N>>& nodes, const std::vector<Object*>& primitives,
+                const BVHLeafIntersector* leafIntersector, const Ray& ray)
+{
+    if (nodes.empty())
+        return false;
+
+    float tMax = (float)std::min(ray.t_max, (double)kInfinity);
+    RayData rayData(ray);
+
+    int stack[64 * (N - 1)];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    alignas(32) float tEnter[N];
+    int order[N];
+    while (stackSize > 0) {
+        const WideBVHNode<N>& node = nodes[stack[--stackSize]];
+        STAT_ADD(kStatNodesVisited, 1);
+        STAT_ADD(kStatBoxTests, N);
+        int hitCount = SortHitChildren(TestChildren(node, rayData, tMax, tEnter), tEnter, order);
+        for (int k = 0; k < hitCount; ++k) {
+            int i = order[k];
+            if (leafIntersector) {
+                if (node.nPrimitives[i] > 0
+                    && leafIntersector->IntersectLeafP(ray, node.child[i], node.nPrimitives[i], tMax))
+                    return true;
+                continue;
+            }
+            for (int p = 0; p < node.nPrimitives[i]; ++p) {
+                if (primitives[node.child[i] + p]->intersect(ray))
+                    return true;
+            }
+        }
+        for (int k = hitCount - 1; k >= 0; --k) {
+            int i = order[k];
+            if (node.nPrimitives[i] == 0)
+                stack[stackSize++] = node.child[i];
+        }
+    }
+    return false;
+}
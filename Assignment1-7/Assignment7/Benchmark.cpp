@@ -0,0 +1,451 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+//
+// Benchmark suite: microbenchmarks of the intersection routines and the BVH,
+// plus fixed-spp renders of the Cornell box scenes, reported as JSON.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Instance.hpp"
+#include "ObjParser.hpp"
+#include "Parallel.hpp"
+#include "Renderer.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "Triangle.hpp"
+#include "global.hpp"
+
+static void usage(const char* binaryName)
+{
+    printf("Usage: %s [options]\n", binaryName);
+    printf("Program Options:\n");
+    printf("  --output <FILE>    JSON report (default: benchmark.json)\n");
+    printf("  --filter <STRING>  Only run benchmarks whose name contains this\n");
+    printf("  --trials <INT>     Timed runs of each microbenchmark and BVH build (default: 5)\n");
+    printf("  --render-trials <INT> Timed runs of each scene render (default: 1)\n");
+    printf("  --spp <INT>        Samples per pixel of the scene renders (default: 4)\n");
+    printf("  --threads <INT>    Render threads (default: all cores)\n");
+    printf("  --models <DIR>     Directory containing cornellbox/ and bunny/ (default: the source tree's models)\n");
+    printf("\n");
+}
+
+struct BenchmarkResult
+{
+    std::string name;
+    int64_t ops = 0;            // 每次运行的操作数: 光线, 三角形或样本
+    std::vector<double> seconds;
+    uint64_t checksum = 0;      // 命中数等, 同一份代码每次都相同, 变了说明结果变了
+};
+
+struct BenchmarkOptions
+{
+    std::string output = "benchmark.json";
+    std::string filter;
+    int trials = 5;
+    int renderTrials = 1;
+    int spp = 4;
+    int threads = 0;
+    std::string modelDir = RAYTRACING_MODEL_DIR;
+};
+
+class BenchmarkRunner
+{
+public:
+    explicit BenchmarkRunner(const BenchmarkOptions& options) : options(options) {}
+
+    bool Enabled(const std::string& name) const
+    {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    // func 执行一次完整的工作并返回校验值, 计时 trials 次
+    template <typename F>
+    void Run(const std::string& name, int64_t ops, int trials, const F& func)
+    {
+        if (!Enabled(name))
+            return;
+        BenchmarkResult result;
+        result.name = name;
+        result.ops = ops;
+        for (int t = 0; t < trials; ++t) {
+            auto start = std::chrono::steady_clock::now();
+            result.checksum = func();
+            auto stop = std::chrono::steady_clock::now();
+            result.seconds.push_back(std::chrono::duration<double>(stop - start).count());
+        }
+        std::sort(result.seconds.begin(), result.seconds.end());
+        fprintf(stderr, "%-40s %12.3f ns/op (min of %d)\n", name.c_str(), NsPerOp(result), trials);
+        results.push_back(result);
+    }
+
+    bool WriteJson() const
+    {
+        FILE* fp = fopen(options.output.c_str(), "w");
+        if (!fp)
+            return false;
+        fprintf(fp, "{\n");
+        fprintf(fp, "  \"spp\": %d,\n  \"threads\": %d,\n", options.spp,
+                options.threads > 0 ? options.threads : NumSystemCores());
+#ifdef RAYTRACING_STATS
+        fprintf(fp, "  \"stats\": true,\n");
+#else
+        fprintf(fp, "  \"stats\": false,\n");
+#endif
+        fprintf(fp, "  \"sse\": %s,\n  \"avx2\": %s,\n", CpuSupportsSSE() ? "true" : "false",
+                CpuSupportsAVX2() ? "true" : "false");
+        fprintf(fp, "  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            fprintf(fp, "    { \"name\": \"%s\", \"ops\": %lld, \"trials\": %d, \"min_seconds\": %.9f, "
+                        "\"median_seconds\": %.9f, \"ns_per_op\": %.4f, \"checksum\": %llu }%s\n",
+                    r.name.c_str(), (long long)r.ops, (int)r.seconds.size(), r.seconds.front(),
+                    r.seconds[r.seconds.size() / 2], NsPerOp(r), (unsigned long long)r.checksum,
+                    i + 1 < results.size() ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+        return fclose(fp) == 0;
+    }
+
+    const BenchmarkOptions& options;
+
+private:
+    // 用最快的一次, 受其他进程干扰最小
+    static double NsPerOp(const BenchmarkResult& r)
+    {
+        return r.seconds.front() * 1e9 / std::max<int64_t>(1, r.ops);
+    }
+
+    std::vector<BenchmarkResult> results;
+};
+
+static Vector3f RandomInBox(PCG32& rng, Bounds3 box)
+{
+    Vector3f d = box.Diagonal();
+    return box.pMin + Vector3f(rng.UniformFloat() * d.x, rng.UniformFloat() * d.y, rng.UniformFloat() * d.z);
+}
+
+static Vector3f RandomDirection(PCG32& rng)
+{
+    float z = 1 - 2 * rng.UniformFloat();
+    float r = std::sqrt(std::max(0.0f, 1 - z * z));
+    float phi = 2 * M_PI * rng.UniformFloat();
+    return Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// 从包围球上的随机点射向包围盒内的随机点, 方向互不相关
+static std::vector<Ray> RandomRays(Bounds3 box, int count, uint64_t seed)
+{
+    PCG32 rng;
+    rng.SetSequence(seed, 0x853c49e6748fea9bULL);
+    Vector3f center = box.Centroid();
+    float radius = box.Diagonal().norm();
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Vector3f origin = center + radius * RandomDirection(rng);
+        rays.emplace_back(origin, normalize(RandomInBox(rng, box) - origin));
+    }
+    return rays;
+}
+
+// 针孔相机在包围盒前方, 按行扫描覆盖整个包围盒, 相邻光线几乎平行
+static std::vector<Ray> CoherentRays(Bounds3 box, int resolution)
+{
+    Vector3f center = box.Centroid();
+    Vector3f d = box.Diagonal();
+    float halfSize = 0.6f * std::max(d.x, d.y);
+    float distance = 2 * d.norm();
+    Vector3f eye = center - Vector3f(0, 0, distance);
+    std::vector<Ray> rays;
+    rays.reserve(resolution * resolution);
+    for (int j = 0; j < resolution; ++j) {
+        for (int i = 0; i < resolution; ++i) {
+            // 取像素中心, 不会出现刚好沿坐标轴的方向
+            float x = (2 * (i + 0.5f) / resolution - 1) * halfSize;
+            float y = (1 - 2 * (j + 0.5f) / resolution) * halfSize;
+            rays.emplace_back(eye, normalize(Vector3f(x, y, distance)));
+        }
+    }
+    return rays;
+}
+
+static void BenchmarkPrimitives(BenchmarkRunner& runner)
+{
+    const int nRays = 1 << 20;
+    const int nTriangles = 1 << 10;
+    Bounds3 unitBox(Vector3f(-1), Vector3f(1));
+    std::vector<Ray> rays = RandomRays(Bounds3(Vector3f(-2), Vector3f(2)), nRays, 1);
+
+    runner.Run("bounds3_intersectp", nRays, runner.options.trials, [&]() {
+        uint64_t hits = 0;
+        for (const Ray& ray : rays) {
+            std::array<int, 3> dirIsNeg = { ray.direction.x > 0, ray.direction.y > 0, ray.direction.z > 0 };
+            hits += unitBox.IntersectP(ray, ray.direction_inv, dirIsNeg, kInfinity);
+        }
+        return hits;
+    });
+
+    // 单位立方体里的小三角形, 第 i 条光线射向第 i % nTriangles 个三角形内的一点附近
+    PCG32 rng;
+    rng.SetSequence(2, 0x853c49e6748fea9bULL);
+    Material material;
+    std::vector<Triangle> triangles;
+    std::vector<Ray> triangleRays;
+    triangles.reserve(nTriangles);
+    for (int i = 0; i < nTriangles; ++i) {
+        Vector3f v0 = RandomInBox(rng, unitBox);
+        triangles.emplace_back(v0, v0 + 0.5f * RandomDirection(rng), v0 + 0.5f * RandomDirection(rng), &material);
+    }
+    for (int i = 0; i < nRays; ++i) {
+        const Triangle& tri = triangles[i % nTriangles];
+        Vector3f target = (tri.v0 + tri.v1 + tri.v2) / 3 + 0.1f * RandomDirection(rng);
+        Vector3f origin = target + 3.0f * RandomDirection(rng);
+        triangleRays.emplace_back(origin, normalize(target - origin));
+    }
+
+    runner.Run("triangle_getintersection", nRays, runner.options.trials, [&]() {
+        uint64_t hits = 0;
+        for (int i = 0; i < nRays; ++i)
+            hits += triangles[i % nTriangles].getIntersection(triangleRays[i]).happened;
+        return hits;
+    });
+
+    runner.Run("ray_triangle_intersect", nRays, runner.options.trials, [&]() {
+        uint64_t hits = 0;
+        for (int i = 0; i < nRays; ++i) {
+            const Triangle& tri = triangles[i % nTriangles];
+            float tnear, u, v;
+            hits += rayTriangleIntersect(tri.v0, tri.v1, tri.v2, triangleRays[i].origin,
+                                         triangleRays[i].direction, tnear, u, v);
+        }
+        return hits;
+    });
+}
+
+static bool BenchmarkBVH(BenchmarkRunner& runner)
+{
+    std::string filename = runner.options.modelDir + "/bunny/bunny.obj";
+    ObjMesh mesh;
+    std::string error;
+    if (!ParseObj(filename, mesh, error)) {
+        std::cerr << error << "\n";
+        return false;
+    }
+    Material material;
+    std::vector<Triangle> triangles;
+    triangles.reserve(mesh.TriangleCount());
+    for (size_t t = 0; t < mesh.TriangleCount(); ++t) {
+        const int* index = &mesh.positionIndex[3 * t];
+        triangles.emplace_back(mesh.positions[index[0]], mesh.positions[index[1]], mesh.positions[index[2]],
+                               &material);
+    }
+    std::vector<Object*> primitives;
+    for (Triangle& tri : triangles)
+        primitives.push_back(&tri);
+
+    const BVHAccel::SplitMethod splitMethods[] = {
+        BVHAccel::SplitMethod::NAIVE, BVHAccel::SplitMethod::SAH, BVHAccel::SplitMethod::HLBVH
+    };
+    const char* splitNames[] = { "naive", "sah", "hlbvh" };
+    for (int s = 0; s < 3; ++s) {
+        runner.Run(std::string("bvh_build_") + splitNames[s], (int64_t)primitives.size(), runner.options.trials,
+                   [&]() {
+            BVHAccel bvh(primitives, 4, splitMethods[s], BVHAccel::TreeWidth::BINARY);
+            return (uint64_t)bvh.totalNodes;
+        });
+    }
+
+    Bounds3 bounds;
+    for (Object* object : primitives)
+        bounds = Union(bounds, object->getBounds());
+    std::vector<Ray> randomRays = RandomRays(bounds, 1 << 18, 3);
+    std::vector<Ray> coherentRays = CoherentRays(bounds, 512);
+    const BVHAccel::TreeWidth widths[] = {
+        BVHAccel::TreeWidth::BINARY, BVHAccel::TreeWidth::BVH4, BVHAccel::TreeWidth::BVH8
+    };
+    for (int s = 0; s < 3; ++s) {
+        for (BVHAccel::TreeWidth width : widths) {
+            // CPU 不支持的宽度会退回更窄的树, 不重复测
+            if (BVHAccel::SupportedWidth(width) != width)
+                continue;
+            std::string prefix = std::string("bvh_intersect_") + splitNames[s] + "_" + std::to_string((int)width)
+                               + "wide_";
+            if (!runner.Enabled(prefix + "random") && !runner.Enabled(prefix + "coherent"))
+                continue;
+            BVHAccel bvh(primitives, 4, splitMethods[s], width);
+            for (const std::vector<Ray>* rays : { &randomRays, &coherentRays }) {
+                runner.Run(prefix + (rays == &randomRays ? "random" : "coherent"), (int64_t)rays->size(),
+                           runner.options.trials, [&]() {
+                    uint64_t hits = 0;
+                    for (const Ray& ray : *rays)
+                        hits += bvh.Intersect(ray).happened;
+                    return hits;
+                });
+            }
+        }
+    }
+
+    // 顶点动画每帧的开销: 顶点沿正弦波摆动后 UpdateVertices (refit, 代价涨多了才局部重建,
+    // 再重新打包三角形块), 和每帧从头建树的 bvh_build_sah 对比
+    if (runner.Enabled("mesh_update_vertices")) {
+        MeshTriangle animated(filename, &material, 4, BVHAccel::SplitMethod::SAH, BVHAccel::TreeWidth::BINARY,
+                              false);
+        std::vector<Vector3f> rest(animated.positions.begin(), animated.positions.end());
+        Bounds3 box = animated.getBounds();
+        float amplitude = 0.02f * box.Diagonal().norm();
+        float frequency = 2 * M_PI / box.Diagonal().x;
+        int frame = 0;
+        runner.Run("mesh_update_vertices", (int64_t)animated.TriangleCount(), runner.options.trials, [&]() {
+            std::vector<Vector3f> positions(rest);
+            float phase = 0.5f * ++frame;
+            for (Vector3f& v : positions)
+                v.y += amplitude * std::sin(phase + frequency * v.x);
+            animated.UpdateVertices(std::move(positions));
+            return (uint64_t)animated.bvh->totalNodes;
+        });
+    }
+    return true;
+}
+
+// 与 main.cpp 默认参数相同的 Cornell box. bunny 为 true 时高盒子换成放大的兔子.
+// 有模型读不了时 loaded 为 false, 场景不完整
+struct BenchmarkScene
+{
+    BenchmarkScene(const std::string& modelDir, bool bunny) : scene(784 / 2, 784 / 2)
+    {
+        Material* red = NewMaterial(Vector3f(0.63f, 0.065f, 0.05f));
+        Material* green = NewMaterial(Vector3f(0.14f, 0.45f, 0.091f));
+        Material* white = NewMaterial(Vector3f(0.725f, 0.71f, 0.68f));
+        Material* light = NewMaterial(Vector3f(0.65f));
+        light->m_emission = 8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f)
+                          + 15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f)
+                          + 18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f);
+
+        std::string path = modelDir + "/cornellbox";
+        AddMesh(path + "/floor.obj", white);
+        AddMesh(path + "/left.obj", red);
+        AddMesh(path + "/right.obj", green);
+        AddMesh(path + "/light.obj", light);
+        AddMesh(path + "/shortbox.obj", white);
+        if (!bunny) {
+            AddMesh(path + "/tallbox.obj", white);
+        }
+        else {
+            // 兔子的模型空间只有 0.15 左右, 放大后站在高盒子原来的位置
+            MeshTriangle* mesh = NewMesh(modelDir + "/bunny/bunny.obj", white);
+            if (!loaded)
+                return;
+            Bounds3 box = mesh->getBounds();
+            Vector3f base(box.Centroid().x, box.pMin.y, box.Centroid().z);
+            Transform transform = Transform::Translate(Vector3f(368, 0, 351))
+                                * Transform::Rotate(180, Vector3f(0, 1, 0))
+                                * Transform::Scale(300 / box.Diagonal().y)
+                                * Transform::Translate(-base);
+            instance.reset(new Instance(mesh, transform));
+            scene.Add(instance.get());
+        }
+        if (loaded)
+            scene.buildBVH(4, BVHAccel::SplitMethod::SAH, BVHAccel::TreeWidth::BINARY);
+    }
+
+    Material* NewMaterial(const Vector3f& kd)
+    {
+        materials.emplace_back(new Material(DIFFUSE, Vector3f(0.0f)));
+        materials.back()->Kd = kd;
+        return materials.back().get();
+    }
+
+    MeshTriangle* NewMesh(const std::string& filename, Material* material)
+    {
+        // 不用缓存, 加载时间每次都包含解析和建树
+        meshes.emplace_back(new MeshTriangle(filename, material, 4, BVHAccel::SplitMethod::SAH,
+                                             BVHAccel::TreeWidth::BINARY, false));
+        loaded = loaded && meshes.back()->loaded();
+        return meshes.back().get();
+    }
+
+    void AddMesh(const std::string& filename, Material* material) { scene.Add(NewMesh(filename, material)); }
+
+    Scene scene;
+    std::vector<std::unique_ptr<Material>> materials;
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+    std::unique_ptr<Instance> instance;
+    bool loaded = true;
+};
+
+static bool BenchmarkScenes(BenchmarkRunner& runner)
+{
+    const BenchmarkOptions& options = runner.options;
+    for (bool bunny : { false, true }) {
+        std::string name = bunny ? "bunny" : "cornell";
+        std::string renderName = "render_" + name + "_spp" + std::to_string(options.spp);
+        if (!runner.Enabled("load_" + name) && !runner.Enabled(renderName))
+            continue;
+        std::unique_ptr<BenchmarkScene> scene;
+        runner.Run("load_" + name, 1, 1, [&]() {
+            scene.reset(new BenchmarkScene(options.modelDir, bunny));
+            return (uint64_t)scene->scene.objects.size();
+        });
+        if (!scene)
+            scene.reset(new BenchmarkScene(options.modelDir, bunny));
+        if (!scene->loaded)
+            return false;
+
+        RenderOptions renderOptions;
+        renderOptions.spp = options.spp;
+        renderOptions.threads = options.threads;
+        Renderer renderer(renderOptions);
+        int64_t samples = (int64_t)scene->scene.width * scene->scene.height * options.spp;
+        bool ok = true;
+        runner.Run(renderName, samples, options.renderTrials, [&]() {
+            ok = renderer.Render(scene->scene) && ok;
+            return (uint64_t)samples;
+        });
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            options.output = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (!strcmp(argv[i], "--trials") && i + 1 < argc)
+            options.trials = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--render-trials") && i + 1 < argc)
+            options.renderTrials = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--spp") && i + 1 < argc)
+            options.spp = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--models") && i + 1 < argc)
+            options.modelDir = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    BenchmarkRunner runner(options);
+    BenchmarkPrimitives(runner);
+    if (!BenchmarkBVH(runner) || !BenchmarkScenes(runner))
+        return 1;
+    if (!runner.WriteJson()) {
+        std::cerr << "Cannot write " << options.output << "\n";
+        return 1;
+    }
+    printf("Wrote %s\n", options.output.c_str());
+    return 0;
+}
@@ -86,6 +86,8 @@ class Bounds3
 
     inline bool IntersectP(const Ray& ray, const Vector3f& invDir,
                            const std::array<int, 3>& dirisNeg) const;
+    inline bool IntersectP(const Ray& ray, const Vector3f& invDir,
+                           const std::array<int, 3>& dirisNeg, float tMax) const;
 };
 
 
@@ -114,6 +116,24 @@ inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
     return true;
 }
 
+// ͬ, ֻ [0, tMax] ڽΧвཻ, ޳ȵǰԶĽڵ.
+//  dirIsNeg ֱȡ/Զƽ, Ҫύ.
+inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
+    const std::array<int, 3>& dirIsNeg, float tMax) const
+{
+    const Vector3f& origin = ray.origin;
+    float txMin = ((dirIsNeg[0] ? pMin.x : pMax.x) - origin.x) * invDir.x;
+    float txMax = ((dirIsNeg[0] ? pMax.x : pMin.x) - origin.x) * invDir.x;
+    float tyMin = ((dirIsNeg[1] ? pMin.y : pMax.y) - origin.y) * invDir.y;
+    float tyMax = ((dirIsNeg[1] ? pMax.y : pMin.y) - origin.y) * invDir.y;
+    float tzMin = ((dirIsNeg[2] ? pMin.z : pMax.z) - origin.z) * invDir.z;
+    float tzMax = ((dirIsNeg[2] ? pMax.z : pMin.z) - origin.z) * invDir.z;
+
+    float tEnter = std::max(txMin, std::max(tyMin, tzMin));
+    float tExit = std::min(txMax, std::min(tyMax, tzMax));
+    return tEnter <= tExit && tExit >= 0 && tEnter <= tMax;
+}
+
 inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
 {
     Bounds3 ret;
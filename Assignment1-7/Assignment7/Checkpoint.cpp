@@ -0,0 +1,88 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+//
+// Float accumulation buffer saved between progressive render passes.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "Checkpoint.hpp"
+
+static const char kCheckpointMagic[8] = { 'R', 'T', 'A', 'C', 'C', 'U', 'M', '2' };
+
+// Vector3f 按三个 float 逐个写, 不依赖它在内存里的布局
+static bool WriteVectors(FILE* fp, const std::vector<Vector3f>& v)
+{
+    std::vector<float> data(3 * v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+        data[3 * i + 0] = v[i].x;
+        data[3 * i + 1] = v[i].y;
+        data[3 * i + 2] = v[i].z;
+    }
+    return fwrite(data.data(), sizeof(float), data.size(), fp) == data.size();
+}
+
+static bool ReadVectors(FILE* fp, std::vector<Vector3f>& v)
+{
+    std::vector<float> data(3 * v.size());
+    if (fread(data.data(), sizeof(float), data.size(), fp) != data.size())
+        return false;
+    for (size_t i = 0; i < v.size(); ++i)
+        v[i] = Vector3f(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+    return true;
+}
+
+bool SaveCheckpoint(const std::string& filename, CheckpointHeader header, const Film& film)
+{
+    memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.width = film.width;
+    header.height = film.height;
+    header.spp = 0;
+    for (const PixelStats& stats : film.stats)
+        header.spp = std::max(header.spp, stats.n);
+    header.flags = film.HasAOVs() ? kCheckpointAOVs : 0;
+
+    std::string tmpName = filename + ".tmp";
+    FILE* fp = fopen(tmpName.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && WriteVectors(fp, film.sum);
+    ok = ok && fwrite(film.stats.data(), sizeof(PixelStats), film.stats.size(), fp) == film.stats.size();
+    if (film.HasAOVs()) {
+        ok = ok && WriteVectors(fp, film.albedoSum) && WriteVectors(fp, film.normalSum)
+            && fwrite(film.depthSum.data(), sizeof(float), film.depthSum.size(), fp) == film.depthSum.size();
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        remove(tmpName.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Windows 上 rename 不会覆盖已有文件
+    remove(filename.c_str());
+#endif
+    return rename(tmpName.c_str(), filename.c_str()) == 0;
+}
+
+bool LoadCheckpoint(const std::string& filename, CheckpointHeader& header, Film& film)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return false;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1
+        && memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) == 0
+        && header.width > 0 && header.height > 0;
+    if (ok) {
+        film = Film(header.width, header.height);
+        ok = ReadVectors(fp, film.sum)
+            && fread(film.stats.data(), sizeof(PixelStats), film.stats.size(), fp) == film.stats.size();
+        if (ok && (header.flags & kCheckpointAOVs)) {
+            film.EnableAOVs();
+            ok = ReadVectors(fp, film.albedoSum) && ReadVectors(fp, film.normalSum)
+                && fread(film.depthSum.data(), sizeof(float), film.depthSum.size(), fp) == film.depthSum.size();
+        }
+    }
+    fclose(fp);
+    return ok;
+}
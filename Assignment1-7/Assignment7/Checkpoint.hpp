@@ -0,0 +1,36 @@
+//
+// Float accumulation buffer saved between progressive render passes.
+//
+
+#ifndef RAYTRACING_CHECKPOINT_H
+#define RAYTRACING_CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include "Film.hpp"
+
+// 文件格式: 32 字节的文件头, 后面紧跟 width * height 个 RGB float (小端),
+// 存的是每个像素所有样本的和而不是平均值, 这样续渲时直接往上加就行.
+// 再后面是 width * height 个 PixelStats (n, mean, m2), 自适应采样续渲时要用.
+// flags 带 kCheckpointAOVs 时最后还有反照率和法线之和 (RGB float) 以及深度之和.
+// 文件头长度固定, 可以直接 mmap 后按 float 数组访问.
+struct CheckpointHeader
+{
+    char magic[8];          // "RTACCUM2"
+    int32_t width;
+    int32_t height;
+    uint32_t spp;           // 像素中最多的样本数, 每个像素自己的样本数在 PixelStats 里
+    uint32_t seed;
+    uint32_t sampler;       // SamplerType
+    uint32_t flags;
+};
+
+const uint32_t kCheckpointAOVs = 1;
+
+// 先写到 filename.tmp 再改名, 渲染中途被杀掉也不会留下写了一半的文件
+bool SaveCheckpoint(const std::string& filename, CheckpointHeader header, const Film& film);
+
+// 读取文件头和累积缓冲, film 按文件里的尺寸重建. 文件不存在或格式不对时返回 false
+bool LoadCheckpoint(const std::string& filename, CheckpointHeader& header, Film& film);
+
+#endif //RAYTRACING_CHECKPOINT_H
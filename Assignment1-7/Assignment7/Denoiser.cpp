@@ -0,0 +1,162 @@
+//
+// Edge-avoiding a-trous wavelet denoiser guided by the first-hit AOVs.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Denoiser.hpp"
+#include "Parallel.hpp"
+
+namespace {
+
+// 反照率太暗时除法会放大噪声, 按这个下限算
+const float kMinAlbedo = 0.01f;
+
+Vector3f Demodulate(const Vector3f& c, const Vector3f& albedo)
+{
+    return Vector3f(c.x / std::max(albedo.x, kMinAlbedo),
+                    c.y / std::max(albedo.y, kMinAlbedo),
+                    c.z / std::max(albedo.z, kMinAlbedo));
+}
+
+Vector3f Remodulate(const Vector3f& c, const Vector3f& albedo)
+{
+    return Vector3f(c.x * std::max(albedo.x, kMinAlbedo),
+                    c.y * std::max(albedo.y, kMinAlbedo),
+                    c.z * std::max(albedo.z, kMinAlbedo));
+}
+
+struct Guide
+{
+    Vector3f normal;
+    float depth;
+    float dzdx, dzdy;   // 屏幕空间的深度梯度, 斜着看的平面深度变化快
+    bool valid;         // 相机光线打中了物体
+};
+
+} // namespace
+
+std::vector<Vector3f> Denoise(const Film& film, const DenoiserOptions& options)
+{
+    const int width = film.width, height = film.height;
+    const int nPixels = width * height;
+    const int nThreads = options.threads > 0 ? options.threads : NumSystemCores();
+
+    std::vector<Vector3f> albedo(nPixels), color(nPixels), nextColor(nPixels);
+    std::vector<float> variance(nPixels), nextVariance(nPixels), blurredVariance(nPixels);
+    std::vector<Guide> guide(nPixels);
+
+    ParallelFor(height, [&](int j, int) {
+        for (int i = 0; i < width; ++i) {
+            int m = j * width + i;
+            AOVSample aov = film.AverageAOV(m);
+            albedo[m] = aov.albedo;
+            color[m] = Demodulate(film.Average(m), aov.albedo);
+            guide[m].normal = aov.normal;
+            guide[m].depth = aov.depth;
+            guide[m].valid = aov.depth > 0;
+
+            // 像素均值的方差, 换算到除以反照率之后的亮度上. 只有一个样本时不知道方差,
+            // 当作无穷大, 只靠法线和深度判断边缘
+            const PixelStats& stats = film.stats[m];
+            float a = std::max(Luminance(aov.albedo), kMinAlbedo);
+            variance[m] = stats.n >= 2 ? stats.m2 / (stats.n - 1) / stats.n / (a * a)
+                                       : std::numeric_limits<float>::infinity();
+        }
+    }, nThreads);
+
+    ParallelFor(height, [&](int j, int) {
+        for (int i = 0; i < width; ++i) {
+            int m = j * width + i;
+            auto depthAt = [&](int x, int y) {
+                x = std::min(std::max(x, 0), width - 1);
+                y = std::min(std::max(y, 0), height - 1);
+                return guide[y * width + x].depth;
+            };
+            // 取单侧差分中较小的, 跨越深度边缘时不会得到很大的梯度
+            float z = guide[m].depth;
+            float dx0 = z - depthAt(i - 1, j), dx1 = depthAt(i + 1, j) - z;
+            float dy0 = z - depthAt(i, j - 1), dy1 = depthAt(i, j + 1) - z;
+            guide[m].dzdx = std::fabs(dx0) < std::fabs(dx1) ? dx0 : dx1;
+            guide[m].dzdy = std::fabs(dy0) < std::fabs(dy1) ? dy0 : dy1;
+        }
+    }, nThreads);
+
+    const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    for (int iteration = 0; iteration < options.iterations; ++iteration) {
+        int step = 1 << iteration;
+
+        // 单个像素的方差估计很不稳定, 先用 3x3 高斯模糊一下再用来算权重
+        ParallelFor(height, [&](int j, int) {
+            for (int i = 0; i < width; ++i) {
+                float sum = 0, weightSum = 0;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int x = i + dx, y = j + dy;
+                        if (x < 0 || x >= width || y < 0 || y >= height)
+                            continue;
+                        float w = (dx == 0 ? 2.0f : 1.0f) * (dy == 0 ? 2.0f : 1.0f);
+                        sum += w * variance[y * width + x];
+                        weightSum += w;
+                    }
+                }
+                blurredVariance[j * width + i] = sum / weightSum;
+            }
+        }, nThreads);
+
+        ParallelFor(height, [&](int j, int) {
+            for (int i = 0; i < width; ++i) {
+                int p = j * width + i;
+                const Guide& gp = guide[p];
+                if (!gp.valid) {
+                    nextColor[p] = color[p];
+                    nextVariance[p] = variance[p];
+                    continue;
+                }
+                float lumP = Luminance(color[p]);
+                float lumScale = options.sigmaLuminance * std::sqrt(blurredVariance[p]) + 1e-6f;
+
+                Vector3f colorSum;
+                float varianceSum = 0, weightSum = 0;
+                for (int ky = -2; ky <= 2; ++ky) {
+                    for (int kx = -2; kx <= 2; ++kx) {
+                        int x = i + kx * step, y = j + ky * step;
+                        if (x < 0 || x >= width || y < 0 || y >= height)
+                            continue;
+                        int q = y * width + x;
+                        const Guide& gq = guide[q];
+                        if (!gq.valid)
+                            continue;
+
+                        float h = kernel[kx + 2] * kernel[ky + 2];
+                        float wNormal = std::pow(std::max(0.0f, dotProduct(gp.normal, gq.normal)),
+                                                 options.sigmaNormal);
+                        float depthScale = options.sigmaDepth
+                            * std::fabs(gp.dzdx * (x - i) + gp.dzdy * (y - j)) + 1e-2f;
+                        float wDepth = std::exp(-std::fabs(gp.depth - gq.depth) / depthScale);
+                        float wLum = std::exp(-std::fabs(lumP - Luminance(color[q])) / lumScale);
+
+                        float w = h * wNormal * wDepth * wLum;
+                        if (w <= 0)
+                            continue;
+                        colorSum += w * color[q];
+                        varianceSum += w * w * variance[q];
+                        weightSum += w;
+                    }
+                }
+                // 中心像素的权重为 h > 0, weightSum 不会是 0
+                nextColor[p] = colorSum / weightSum;
+                nextVariance[p] = varianceSum / (weightSum * weightSum);
+            }
+        }, nThreads);
+
+        color.swap(nextColor);
+        variance.swap(nextVariance);
+    }
+
+    std::vector<Vector3f> result(nPixels);
+    for (int m = 0; m < nPixels; ++m)
+        result[m] = guide[m].valid ? Remodulate(color[m], albedo[m]) : film.Average(m);
+    return result;
+}
@@ -0,0 +1,28 @@
+//
+// Edge-avoiding a-trous wavelet denoiser guided by the first-hit AOVs.
+//
+
+#ifndef RAYTRACING_DENOISER_H
+#define RAYTRACING_DENOISER_H
+
+#include <vector>
+#include "Film.hpp"
+
+struct DenoiserOptions
+{
+    int iterations = 5;         // 第 i 次的采样间隔为 2^i, 5 次覆盖 61x61 的邻域
+    float sigmaLuminance = 4;   // 亮度差相对标准差的容忍度
+    float sigmaNormal = 128;    // 法线夹角的指数
+    float sigmaDepth = 1;       // 深度差相对深度梯度的容忍度
+    int threads = 0;
+};
+
+// SVGF (Schied et al. 2017) 的空间滤波部分, 即 Dammertz et al. 2010 的边缘保持
+// a-trous 小波滤波, 用每个像素的方差控制亮度权重:
+//   - 颜色先除以反照率, 只滤光照, 最后再乘回去, 纹理和材质边界不会被抹掉
+//   - 法线和深度不同的像素权重很小, 几何边缘保持清晰
+//   - 样本方差大的像素允许更大的亮度差, 每次迭代方差也跟着滤波并缩小
+// 返回每个像素去噪后的颜色, film 必须带 AOV.
+std::vector<Vector3f> Denoise(const Film& film, const DenoiserOptions& options = DenoiserOptions());
+
+#endif //RAYTRACING_DENOISER_H
@@ -0,0 +1,117 @@
+//
+// Per-pixel sample accumulation and the statistics used by adaptive sampling.
+//
+
+#ifndef RAYTRACING_FILM_H
+#define RAYTRACING_FILM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Vector.hpp"
+
+inline float Luminance(const Vector3f& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+// 相机光线第一个交点的辅助信息 (AOV), 没打中时全为 0
+struct AOVSample
+{
+    Vector3f albedo;    // Material::Kd
+    Vector3f normal;
+    float depth = 0;    // 沿光线的距离
+};
+
+// 像素亮度的在线均值和方差 (Welford), 不用存下每个样本
+struct PixelStats
+{
+    uint32_t n = 0;     // 样本数, 也是这个像素下一个样本的编号
+    float mean = 0;
+    float m2 = 0;       // 与均值之差的平方和
+
+    void Add(float x)
+    {
+        ++n;
+        float delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+
+    // 均值的标准误差相对均值的大小. 很暗的像素按 minMean 算, 免得除以 0,
+    // 全黑且没有方差的背景像素直接认为已经收敛
+    float RelativeError(float minMean = 1e-3f) const
+    {
+        if (n < 2)
+            return std::numeric_limits<float>::infinity();
+        float variance = m2 / (n - 1);
+        return std::sqrt(variance / n) / std::max(mean, minMean);
+    }
+};
+
+// 每个像素的样本之和与统计. 各像素的样本数可以不同, 输出时各自求平均
+struct Film
+{
+    Film(int width, int height)
+        : width(width), height(height), sum(width * height), stats(width * height),
+          active(width * height, 1)
+    {
+    }
+
+    // 同一个像素的样本只能由一个线程添加
+    void AddSample(int pixel, const Vector3f& L)
+    {
+        sum[pixel] += L;
+        stats[pixel].Add(Luminance(L));
+    }
+
+    Vector3f Average(int pixel) const
+    {
+        uint32_t n = stats[pixel].n;
+        return n > 0 ? sum[pixel] * (1.0f / n) : Vector3f();
+    }
+
+    // AOV 和颜色一样按样本累加, 每个样本调用一次 AddAOV, 样本数与 stats 共用
+    void EnableAOVs()
+    {
+        albedoSum.assign(width * height, Vector3f());
+        normalSum.assign(width * height, Vector3f());
+        depthSum.assign(width * height, 0.0f);
+    }
+    bool HasAOVs() const { return !depthSum.empty(); }
+
+    void AddAOV(int pixel, const AOVSample& aov)
+    {
+        albedoSum[pixel] += aov.albedo;
+        normalSum[pixel] += aov.normal;
+        depthSum[pixel] += aov.depth;
+    }
+
+    // 法线取平均后重新归一化, 像素内跨越边缘时长度会小于 1
+    AOVSample AverageAOV(int pixel) const
+    {
+        AOVSample aov;
+        uint32_t n = stats[pixel].n;
+        if (n == 0)
+            return aov;
+        aov.albedo = albedoSum[pixel] * (1.0f / n);
+        Vector3f normal = normalSum[pixel];
+        float len = normal.norm();
+        aov.normal = len > 0 ? normal * (1.0f / len) : Vector3f();
+        aov.depth = depthSum[pixel] / n;
+        return aov;
+    }
+
+    int width, height;
+    std::vector<Vector3f> sum;
+    std::vector<PixelStats> stats;
+    std::vector<uint8_t> active;    // 这一遍还要继续采样的像素
+
+    // 只有 EnableAOVs 之后才有
+    std::vector<Vector3f> albedoSum, normalSum;
+    std::vector<float> depthSum;
+};
+
+#endif //RAYTRACING_FILM_H
@@ -0,0 +1,135 @@
+//
+// An object placed in the scene by a transform, sharing its geometry and
+// bottom-level BVH with every other instance of the same object.
+//
+
+#ifndef RAYTRACING_INSTANCE_H
+#define RAYTRACING_INSTANCE_H
+
+#include "BVH.hpp"
+#include "Object.hpp"
+#include "Transform.hpp"
+
+// 场景的 BVH 是顶层, 叶子里的 Instance 把光线变换到物体空间, 交给共享物体
+// (通常是 MeshTriangle 和它自己的 BVH) 求交, 再把交点变换回世界空间.
+// 物体空间的光线方向不归一化, 所以两边的光线参数 t 相同, tMax 和 distance 可以直接用.
+// 变换的行列式为负 (镜像) 时三角形的朝向会反过来, 背面剔除也跟着反.
+class Instance : public Object
+{
+public:
+    // material 不为空时替换物体自己的材质
+    Instance(Object* object, const Transform& transform, Material* material = nullptr)
+        : object(object), material(material)
+    {
+        SetTransform(transform);
+    }
+
+    // 移动实例后调用 Scene::updateBVH, 只更新顶层
+    void SetTransform(const Transform& transform)
+    {
+        objectToWorld = transform;
+        worldToObject = transform.Inverse();
+        // 相似变换下面积按 |det|^(2/3) 缩放. 发光的实例应只用旋转, 平移和均匀缩放,
+        // 否则光源采样的 pdf 不准
+        areaScale = std::pow(std::fabs(objectToWorld.Determinant()), 2.0f / 3.0f);
+    }
+
+    const Transform& GetTransform() const { return objectToWorld; }
+
+    bool intersect(const Ray& ray) override
+    {
+        return object->intersect(toObject(ray));
+    }
+
+    bool intersect(const Ray& ray, float& tnear, uint32_t& index) const override
+    {
+        return object->intersect(toObject(ray), tnear, index);
+    }
+
+    Intersection getIntersection(Ray ray) override
+    {
+        Intersection hit = object->getIntersection(toObject(ray));
+        if (hit.happened)
+            toWorld(ray, hit);
+        return hit;
+    }
+
+    // 整个包一起变换到物体空间, 共享物体仍然可以做包遍历. 只有比已有交点更近的才换回世界空间
+    void getIntersectionPacket(const Ray* rays, int count, uint32_t activeMask, Intersection* hits) override
+    {
+        Ray localRays[kMaxPacketSize];
+        Intersection localHits[kMaxPacketSize];
+        for (int i = 0; i < count; ++i) {
+            if (activeMask & (1u << i))
+                localRays[i] = toObject(rays[i]);
+            localHits[i] = hits[i];
+        }
+        object->getIntersectionPacket(localRays, count, activeMask, localHits);
+        for (int i = 0; i < count; ++i) {
+            if ((activeMask & (1u << i)) && localHits[i].happened && localHits[i].distance < hits[i].distance) {
+                hits[i] = localHits[i];
+                toWorld(rays[i], hits[i]);
+            }
+        }
+    }
+
+    uint32_t intersectPacketP(const Ray* rays, int count, uint32_t activeMask) override
+    {
+        Ray localRays[kMaxPacketSize];
+        for (int i = 0; i < count; ++i) {
+            if (activeMask & (1u << i))
+                localRays[i] = toObject(rays[i]);
+        }
+        return object->intersectPacketP(localRays, count, activeMask);
+    }
+
+    void getSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index,
+                              const Vector2f& uv, Vector3f& N, Vector2f& st) const override
+    {
+        object->getSurfaceProperties(worldToObject.Point(P), worldToObject.Vector(I), index, uv, N, st);
+        N = normalize(objectToWorld.Normal(N));
+    }
+
+    Vector3f evalDiffuseColor(const Vector2f& st) const override { return object->evalDiffuseColor(st); }
+    // 每次都从物体的包围盒变换, 共享的网格变形之后也是对的
+    Bounds3 getBounds() override { return objectToWorld(object->getBounds()); }
+    float getArea() override { return object->getArea() * areaScale; }
+
+    void Sample(Intersection& pos, float& pdf, Sampler& sampler) override
+    {
+        object->Sample(pos, pdf, sampler);
+        pos.coords = objectToWorld.Point(pos.coords);
+        pos.normal = normalize(objectToWorld.Normal(pos.normal));
+        pdf /= areaScale;
+        if (material)
+            pos.emit = material->getEmission();
+    }
+
+    bool hasEmit() override { return material ? material->hasEmission() : object->hasEmit(); }
+
+private:
+    Ray toObject(const Ray& ray) const
+    {
+        Ray r(worldToObject.Point(ray.origin), worldToObject.Vector(ray.direction));
+        r.t_min = ray.t_min;
+        r.t_max = ray.t_max;
+        return r;
+    }
+
+    // 物体空间的交点变换回世界空间, 交点属于这个实例
+    void toWorld(const Ray& ray, Intersection& hit) const
+    {
+        hit.coords = ray(hit.distance);
+        hit.normal = normalize(objectToWorld.Normal(hit.normal));
+        hit.obj = const_cast<Instance*>(this);
+        if (material)
+            hit.m = material;
+    }
+
+    Object* object;
+    Material* material;
+    Transform objectToWorld, worldToObject;
+    float areaScale;
+};
+
+#endif //RAYTRACING_INSTANCE_H
@@ -0,0 +1,107 @@
+//
+// Read-only memory-mapped files and arrays that either own their elements or
+// point into a mapped file.
+//
+
+#ifndef RAYTRACING_MAPPEDFILE_H
+#define RAYTRACING_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 只读映射整个文件, 多个进程映射同一个文件时共用页缓存里的同一份数据
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // 文件不存在或映射失败时返回 false
+    bool Open(const std::string& filename);
+    void Close();
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(view); }
+    size_t size() const { return length; }
+
+private:
+    void* view = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+// 建树时像 std::vector 一样拥有元素; 从缓存读出时只指向 MappedFile 中的一段, 不拷贝.
+// 修改元素时 (非 const 的 operator[]) 会先把映射的内容拷贝出来, 遍历只用 const 的接口.
+template <typename T>
+class MappedArray
+{
+public:
+    MappedArray() = default;
+    MappedArray(const MappedArray&) = delete;
+    MappedArray& operator=(const MappedArray&) = delete;
+    MappedArray(MappedArray&& other) noexcept { *this = std::move(other); }
+    MappedArray& operator=(MappedArray&& other) noexcept
+    {
+        // vector 移动时不会搬动元素, 拥有元素时 ptr 仍然有效
+        owned = std::move(other.owned);
+        ptr = other.ptr;
+        count = other.count;
+        other.owned.clear();
+        other.ptr = nullptr;
+        other.count = 0;
+        return *this;
+    }
+
+    // data 指向的内存由调用者保证在数组销毁前有效
+    static MappedArray View(const T* data, size_t count)
+    {
+        MappedArray array;
+        array.ptr = data;
+        array.count = count;
+        return array;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* data() const { return ptr; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+
+    // 指向缓存时先拷贝出来再返回, 只读的地方应该用 const 的接口, 免得整段拷贝
+    T& operator[](size_t i)
+    {
+        detach();
+        return owned[i];
+    }
+    void resize(size_t n) { detach(); owned.resize(n); sync(); }
+    void assign(size_t n, const T& value) { owned.assign(n, value); sync(); }
+    void push_back(const T& value) { detach(); owned.push_back(value); sync(); }
+    void assign(std::vector<T>&& values) { owned = std::move(values); sync(); }
+    // 指向缓存时先拷贝出来, 之后就可以修改
+    void detach()
+    {
+        if (ptr != owned.data()) {
+            owned.assign(ptr, ptr + count);
+            sync();
+        }
+    }
+
+private:
+    void sync()
+    {
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    std::vector<T> owned;
+    const T* ptr = nullptr;
+    size_t count = 0;
+};
+
+#endif //RAYTRACING_MAPPEDFILE_H
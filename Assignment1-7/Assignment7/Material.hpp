@@ -6,8 +6,11 @@
 #define RAYTRACING_MATERIAL_H
 
 #include "Vector.hpp"
+#include "Sampler.hpp"
 
-enum MaterialType { DIFFUSE};
+// MICROFACET_CONDUCTOR: GGX 金属, Ks 是法线方向的反射率 F0
+// MICROFACET_DIELECTRIC: GGX 电介质镜面反射 (折射率 ior) 叠在漫反射 Kd 上, 类似塑料/清漆
+enum MaterialType { DIFFUSE, MICROFACET_CONDUCTOR, MICROFACET_DIELECTRIC };
 
 class Material{
 private:
@@ -71,8 +74,8 @@ private:
         // kt = 1 - kr;
     }
 
-    Vector3f toWorld(const Vector3f &a, const Vector3f &N){
-        Vector3f B, C;
+    // 以 N 为 z 轴的局部坐标系
+    void coordinateSystem(const Vector3f &N, Vector3f &B, Vector3f &C) const {
         if (std::fabs(N.x) > std::fabs(N.y)){
             float invLen = 1.0f / std::sqrt(N.x * N.x + N.z * N.z);
             C = Vector3f(N.z * invLen, 0.0f, -N.x *invLen);
@@ -82,9 +85,110 @@ private:
             C = Vector3f(0.0f, N.z * invLen, -N.y *invLen);
         }
         B = crossProduct(C, N);
+    }
+
+    Vector3f toWorld(const Vector3f &a, const Vector3f &N){
+        Vector3f B, C;
+        coordinateSystem(N, B, C);
         return a.x * B + a.y * C + a.z * N;
     }
 
+    Vector3f toLocal(const Vector3f &a, const Vector3f &N){
+        Vector3f B, C;
+        coordinateSystem(N, B, C);
+        return Vector3f(dotProduct(a, B), dotProduct(a, C), dotProduct(a, N));
+    }
+
+    // GGX 的 alpha, 太小时数值上不稳定
+    float alpha() const { return std::max(1e-3f, roughness * roughness); }
+
+    // GGX (Trowbridge-Reitz) 法线分布, cosTheta 是微表面法线 h 与 N 的夹角余弦
+    static float GGXDistribution(float cosTheta, float alpha)
+    {
+        if (cosTheta <= 0)
+            return 0;
+        float a2 = alpha * alpha;
+        float d = cosTheta * cosTheta * (a2 - 1) + 1;
+        return a2 / (M_PI * d * d);
+    }
+
+    // Smith 遮蔽函数的 Lambda, G1 = 1 / (1 + Lambda), 高度相关的 G2 = 1 / (1 + Lambda(v) + Lambda(l))
+    static float SmithLambda(float cosTheta, float alpha)
+    {
+        float cos2 = cosTheta * cosTheta;
+        float tan2 = std::max(0.0f, 1 - cos2) / cos2;
+        return (std::sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+    }
+
+    // 按可见法线分布 D_v(h) = G1(v) max(0, v.h) D(h) / cos(v) 采样局部坐标下的微表面法线 (Heitz 2018).
+    // v 指向观察者, 在 N 为 z 轴的局部坐标下
+    static Vector3f sampleVisibleNormal(const Vector3f &v, float alpha, const Vector2f &u)
+    {
+        // 把椭球拉伸成半球, 在 v 看到的投影圆盘上均匀取点
+        Vector3f vh = normalize(Vector3f(alpha * v.x, alpha * v.y, v.z));
+        float lensq = vh.x * vh.x + vh.y * vh.y;
+        Vector3f t1 = lensq > 0 ? Vector3f(-vh.y, vh.x, 0) / std::sqrt(lensq) : Vector3f(1, 0, 0);
+        Vector3f t2 = crossProduct(vh, t1);
+        float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+        float p1 = r * std::cos(phi), p2 = r * std::sin(phi);
+        float s = 0.5f * (1 + vh.z);
+        p2 = (1 - s) * std::sqrt(std::max(0.0f, 1 - p1 * p1)) + s * p2;
+        Vector3f nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0f, 1 - p1 * p1 - p2 * p2)) * vh;
+        // 再压缩回椭球
+        return normalize(Vector3f(alpha * nh.x, alpha * nh.y, std::max(0.0f, nh.z)));
+    }
+
+    // 电介质表面对入射光线 I 的反射率
+    float dielectricFresnel(const Vector3f &I, const Vector3f &N) const
+    {
+        float kr;
+        fresnel(I, N, ior, kr);
+        return kr;
+    }
+
+    // 电介质材质选择镜面反射的概率: 按两部分大致的反照率分配, 并留出余量给另一部分
+    float specularProbability(const Vector3f &wi, const Vector3f &N) const
+    {
+        if (m_type == MICROFACET_CONDUCTOR)
+            return 1.0f;
+        float F = dielectricFresnel(wi, N);
+        float diffuse = (1 - F) * (Kd.x + Kd.y + Kd.z) / 3;
+        float p = F + diffuse > 0 ? F / (F + diffuse) : 1.0f;
+        return clamp(0.25f, 0.75f, p);
+    }
+
+    // 只采样 GGX 反射时出射方向 wo 的 pdf: D_v(h) / (4 v.h) = G1(v) D(h) / (4 cos(v))
+    float specularPdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N) const
+    {
+        float cosV = -dotProduct(wi, N), cosL = dotProduct(wo, N);
+        if (cosV <= 0 || cosL <= 0)
+            return 0.0f;
+        Vector3f h = normalize(wo - wi);
+        float a = alpha();
+        return GGXDistribution(dotProduct(h, N), a) / (1 + SmithLambda(cosV, a)) / (4 * cosV);
+    }
+
+    // GGX 反射的 BRDF: F D G2 / (4 cos(v) cos(l))
+    Vector3f specularEval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N) const
+    {
+        float cosV = -dotProduct(wi, N), cosL = dotProduct(wo, N);
+        if (cosV <= 0 || cosL <= 0)
+            return Vector3f(0.0f);
+        Vector3f h = normalize(wo - wi);
+        float a = alpha();
+        float D = GGXDistribution(dotProduct(h, N), a);
+        float G = 1 / (1 + SmithLambda(cosV, a) + SmithLambda(cosL, a));
+        Vector3f F;
+        if (m_type == MICROFACET_CONDUCTOR) {
+            // Schlick 近似, Ks 是金属的 F0
+            float c = std::pow(1 - clamp(0, 1, dotProduct(wo, h)), 5.0f);
+            F = Ks + (Vector3f(1.0f) - Ks) * c;
+        }
+        else
+            F = Vector3f(dielectricFresnel(wi, h));
+        return F * (D * G / (4 * cosV * cosL));
+    }
+
 public:
     MaterialType m_type;
     //Vector3f m_color;
@@ -92,6 +196,7 @@ public:
     float ior;
     Vector3f Kd, Ks;
     float specularExponent;
+    float roughness;    // 微表面材质的粗糙度, GGX 的 alpha = roughness^2
     //Texture tex;
 
     inline Material(MaterialType t=DIFFUSE, Vector3f e=Vector3f(0,0,0));
@@ -100,9 +205,11 @@ public:
     inline Vector3f getColorAt(double u, double v);
     inline Vector3f getEmission();
     inline bool hasEmission();
+    // 表面的基础颜色, 给 AOV 和降噪用
+    inline Vector3f getAlbedo();
 
     // sample a ray by Material properties
-    inline Vector3f sample(const Vector3f &wi, const Vector3f &N);
+    inline Vector3f sample(const Vector3f &wi, const Vector3f &N, Sampler &sampler);
     // given a ray, calculate the PdF of this ray
     inline float pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
     // given a ray, calculate the contribution of this ray
@@ -114,6 +221,8 @@ Material::Material(MaterialType t, Vector3f e){
     m_type = t;
     //m_color = c;
     m_emission = e;
+    ior = 1.5f;
+    roughness = 0.3f;
 }
 
 MaterialType Material::getType(){return m_type;}
@@ -124,24 +233,46 @@ bool Material::hasEmission() {
     else return false;
 }
 
+Vector3f Material::getAlbedo() {
+    return m_type == MICROFACET_CONDUCTOR ? Ks : Kd;
+}
+
 Vector3f Material::getColorAt(double u, double v) {
     return Vector3f();
 }
 
 
-Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
+Vector3f Material::sample(const Vector3f &wi, const Vector3f &N, Sampler &sampler){
     switch(m_type){
         case DIFFUSE:
         {
-            // uniform sample on the hemisphere
-            float x_1 = get_random_float(), x_2 = get_random_float();
-            float z = std::fabs(1.0f - 2.0f * x_1);
-            float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * x_2;
+            // cosine-weighted sample on the hemisphere: 在单位圆盘上均匀取点再投影到半球 (Malley)
+            Vector2f u = sampler.Get2D();
+            float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+            float z = std::sqrt(std::max(0.0f, 1.0f - u.x));
             Vector3f localRay(r*std::cos(phi), r*std::sin(phi), z);
             return toWorld(localRay, N);
             
             break;
         }
+        case MICROFACET_CONDUCTOR:
+        case MICROFACET_DIELECTRIC:
+        {
+            // 电介质先决定采样镜面反射还是下面的漫反射
+            if (m_type == MICROFACET_DIELECTRIC && sampler.Get1D() >= specularProbability(wi, N)) {
+                Vector2f u = sampler.Get2D();
+                float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+                float z = std::sqrt(std::max(0.0f, 1.0f - u.x));
+                return toWorld(Vector3f(r*std::cos(phi), r*std::sin(phi), z), N);
+            }
+            // 从观察方向能看到的微表面法线中采样, 再按它反射. 反射到表面以下时 pdf 为 0
+            Vector3f v = toLocal(-wi, N);
+            if (v.z <= 0)
+                return reflect(wi, N);
+            Vector3f h = toWorld(sampleVisibleNormal(v, alpha(), sampler.Get2D()), N);
+            return reflect(wi, h);
+            break;
+        }
     }
 }
 
@@ -149,13 +280,24 @@ float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
     switch(m_type){
         case DIFFUSE:
         {
-            // uniform sample probability 1 / (2 * PI)
-            if (dotProduct(wo, N) > 0.0f)
-                return 0.5f / M_PI;
+            // cosine-weighted sample probability cos(theta) / PI
+            float cosTheta = dotProduct(wo, N);
+            if (cosTheta > 0.0f)
+                return cosTheta / M_PI;
             else
                 return 0.0f;
             break;
         }
+        case MICROFACET_CONDUCTOR:
+            return specularPdf(wi, wo, N);
+        case MICROFACET_DIELECTRIC:
+        {
+            float cosTheta = dotProduct(wo, N);
+            if (cosTheta <= 0.0f)
+                return 0.0f;
+            float pSpecular = specularProbability(wi, N);
+            return pSpecular * specularPdf(wi, wo, N) + (1 - pSpecular) * cosTheta / M_PI;
+        }
     }
 }
 
@@ -173,6 +315,17 @@ Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &
                 return Vector3f(0.0f);
             break;
         }
+        case MICROFACET_CONDUCTOR:
+            return specularEval(wi, wo, N);
+        case MICROFACET_DIELECTRIC:
+        {
+            // 没被镜面反射的光进入漫反射层, 出来时再透过一次界面
+            float cosL = dotProduct(wo, N);
+            if (cosL <= 0.0f || dotProduct(wi, N) >= 0.0f)
+                return Vector3f(0.0f);
+            float transmit = (1 - dielectricFresnel(wi, N)) * (1 - dielectricFresnel(-wo, N));
+            return specularEval(wi, wo, N) + Kd / M_PI * transmit;
+        }
     }
 }
 
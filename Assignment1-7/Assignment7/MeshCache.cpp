@@ -0,0 +1,255 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+//
+// Binary cache of a mesh's triangles and prebuilt BVH, memory-mapped on load.
+//
+
+#include <cstdio>
+#include <cstring>
+#include "MeshCache.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char kMeshCacheMagic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 'C', 'A' };
+// 任何一个缓存结构体的布局或建树算法变了都要加 1
+static const uint32_t kMeshCacheVersion = 3;
+static const uint64_t kSectionAlignment = 64;
+
+enum MeshCacheSectionId {
+    kPositions, kIndices, kFaceOrder, kNodes, kWideNodes4, kWideNodes8, kBlocks4, kBlocks8,
+    kSectionCount
+};
+
+struct MeshCacheHeader
+{
+    char magic[8];          // "RTMESHCA"
+    uint32_t version;
+    uint32_t sectionCount;
+    MeshCacheKey key;
+    float bounds[6];        // pMin, pMax
+    float area;
+    uint32_t elementSize[kSectionCount];
+    uint32_t count[kSectionCount];
+    uint64_t offset[kSectionCount];     // 从文件开头算起
+};
+
+// 按下标访问 MeshCacheData 的各段
+struct SectionRef
+{
+    const void** data;
+    uint32_t* count;
+    uint32_t elementSize;
+};
+
+template <typename T>
+static SectionRef Ref(MeshCacheSection<T>& section)
+{
+    return { reinterpret_cast<const void**>(&section.data), &section.count, (uint32_t)sizeof(T) };
+}
+
+static void GetSections(MeshCacheData& data, SectionRef sections[kSectionCount])
+{
+    sections[kPositions] = Ref(data.positions);
+    sections[kIndices] = Ref(data.indices);
+    sections[kFaceOrder] = Ref(data.faceOrder);
+    sections[kNodes] = Ref(data.nodes);
+    sections[kWideNodes4] = Ref(data.wideNodes4);
+    sections[kWideNodes8] = Ref(data.wideNodes8);
+    sections[kBlocks4] = Ref(data.blocks4);
+    sections[kBlocks8] = Ref(data.blocks8);
+}
+
+static bool SameKey(const MeshCacheKey& a, const MeshCacheKey& b)
+{
+    return a.sourceHash == b.sourceHash && a.maxPrimsInNode == b.maxPrimsInNode
+        && a.splitMethod == b.splitMethod && a.treeWidth == b.treeWidth && a.blockWidth == b.blockWidth;
+}
+
+bool HashFile(const std::string& filename, uint64_t& hash)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return false;
+    hash = 14695981039346656037ull;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static int ProcessId()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return (int)getpid();
+#endif
+}
+
+std::string MeshCachePath(const std::string& sourceFile, const MeshCacheKey& key)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int32_t value : { key.maxPrimsInNode, key.splitMethod, key.treeWidth, key.blockWidth }) {
+        for (int byte = 0; byte < 4; ++byte) {
+            hash ^= (uint32_t)value >> (8 * byte) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    char digest[16];
+    snprintf(digest, sizeof(digest), "%08x", (uint32_t)(hash ^ hash >> 32));
+    return sourceFile + "." + digest + ".cache";
+}
+
+// 节点引用的孩子和三角形区间都要在范围内. 孩子总在父节点之后 (深度优先压平),
+// 这样损坏或者不匹配的文件不会在遍历时越界或者死循环
+static bool ValidNodes(const LinearBVHNode* nodes, uint32_t count, uint32_t nTriangles)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const LinearBVHNode& node = nodes[i];
+        if (node.nPrimitives > 0) {
+            if (node.primitivesOffset < 0 || (uint64_t)node.primitivesOffset + node.nPrimitives > nTriangles)
+                return false;
+        }
+        else if (node.secondChildOffset <= (int64_t)i + 1 || (uint32_t)node.secondChildOffset >= count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 空槽 (child = -1) 的包围盒必须是反的, 遍历时才不会进去
+template <int N>
+static bool ValidWideNodes(const WideBVHNode<N>* nodes, uint32_t count, uint32_t nTriangles)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const WideBVHNode<N>& node = nodes[i];
+        for (int j = 0; j < N; ++j) {
+            int child = node.child[j];
+            if (child == -1) {
+                if (!(node.bounds[0][j] > node.bounds[3][j]))
+                    return false;
+            }
+            else if (node.nPrimitives[j] > 0) {
+                if (child < 0 || (uint64_t)child + node.nPrimitives[j] > nTriangles)
+                    return false;
+            }
+            else if (child <= (int64_t)i || (uint32_t)child >= count) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool WriteMeshCache(const std::string& filename, const MeshCacheKey& key, const MeshCacheData& data)
+{
+    MeshCacheData copy = data;
+    SectionRef sections[kSectionCount];
+    GetSections(copy, sections);
+
+    MeshCacheHeader header;
+    memset(static_cast<void*>(&header), 0, sizeof(header));
+    memcpy(header.magic, kMeshCacheMagic, sizeof(header.magic));
+    header.version = kMeshCacheVersion;
+    header.sectionCount = kSectionCount;
+    header.key = key;
+    for (int axis = 0; axis < 3; ++axis) {
+        header.bounds[axis] = data.bounds.pMin[axis];
+        header.bounds[axis + 3] = data.bounds.pMax[axis];
+    }
+    header.area = data.area;
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < kSectionCount; ++i) {
+        offset = (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+        header.elementSize[i] = sections[i].elementSize;
+        header.count[i] = *sections[i].count;
+        header.offset[i] = offset;
+        offset += (uint64_t)header.count[i] * header.elementSize[i];
+    }
+
+    std::string tmpName = filename + "." + std::to_string(ProcessId()) + ".tmp";
+    FILE* fp = fopen(tmpName.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    uint64_t position = sizeof(header);
+    static const char padding[kSectionAlignment] = {};
+    for (int i = 0; i < kSectionCount && ok; ++i) {
+        size_t pad = (size_t)(header.offset[i] - position);
+        size_t bytes = (size_t)header.count[i] * header.elementSize[i];
+        ok = fwrite(padding, 1, pad, fp) == pad
+            && (bytes == 0 || fwrite(*sections[i].data, 1, bytes, fp) == bytes);
+        position = header.offset[i] + bytes;
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        remove(tmpName.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Windows 上 rename 不会覆盖已有文件
+    remove(filename.c_str());
+#endif
+    return rename(tmpName.c_str(), filename.c_str()) == 0;
+}
+
+bool ReadMeshCache(const std::string& filename, const MeshCacheKey& key, MappedFile& file,
+                   MeshCacheData& data)
+{
+    if (!file.Open(filename))
+        return false;
+    MeshCacheHeader header;
+    if (file.size() < sizeof(header)) {
+        file.Close();
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+
+    SectionRef sections[kSectionCount];
+    GetSections(data, sections);
+    bool ok = memcmp(header.magic, kMeshCacheMagic, sizeof(header.magic)) == 0
+        && header.version == kMeshCacheVersion && header.sectionCount == kSectionCount
+        && SameKey(header.key, key);
+    for (int i = 0; i < kSectionCount && ok; ++i) {
+        ok = header.elementSize[i] == sections[i].elementSize
+            && header.offset[i] % kSectionAlignment == 0
+            && header.offset[i] + (uint64_t)header.count[i] * header.elementSize[i] <= file.size();
+    }
+    uint32_t nTriangles = header.count[kFaceOrder];
+    // 三角形连续装进块里, 最后一块可以不满
+    uint32_t nBlocks = header.count[key.blockWidth == 8 ? kBlocks8 : kBlocks4];
+    ok = ok && header.count[kIndices] == 3 * nTriangles && header.count[kNodes] > 0
+        && nBlocks == (nTriangles + key.blockWidth - 1) / key.blockWidth
+        && (key.treeWidth != 4 || header.count[kWideNodes4] > 0)
+        && (key.treeWidth != 8 || header.count[kWideNodes8] > 0);
+    if (ok) {
+        for (int i = 0; i < kSectionCount; ++i) {
+            *sections[i].data = file.data() + header.offset[i];
+            *sections[i].count = header.count[i];
+        }
+        ok = ValidNodes(data.nodes.data, data.nodes.count, nTriangles)
+            && ValidWideNodes(data.wideNodes4.data, data.wideNodes4.count, nTriangles)
+            && ValidWideNodes(data.wideNodes8.data, data.wideNodes8.count, nTriangles);
+    }
+    if (!ok) {
+        data = MeshCacheData();
+        file.Close();
+        return false;
+    }
+
+    data.bounds = Bounds3(Vector3f(header.bounds[0], header.bounds[1], header.bounds[2]),
+                          Vector3f(header.bounds[3], header.bounds[4], header.bounds[5]));
+    data.area = header.area;
+    return true;
+}
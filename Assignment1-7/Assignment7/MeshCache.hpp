@@ -0,0 +1,65 @@
+//
+// Binary cache of a mesh's triangles and prebuilt BVH, memory-mapped on load.
+//
+
+#ifndef RAYTRACING_MESHCACHE_H
+#define RAYTRACING_MESHCACHE_H
+
+#include <cstdint>
+#include <string>
+#include "BVH.hpp"
+#include "MappedFile.hpp"
+#include "TriangleBlock.hpp"
+
+// 缓存对应的源文件和建树参数, 任何一项不同缓存就失效
+struct MeshCacheKey
+{
+    uint64_t sourceHash = 0;    // OBJ 文件内容的 FNV-1a 哈希
+    int32_t maxPrimsInNode = 0;
+    int32_t splitMethod = 0;
+    int32_t treeWidth = 0;      // BVHAccel::SupportedWidth 之后的树宽
+    int32_t blockWidth = 0;     // 三角形块的宽度, 4 或 8
+};
+
+// 文件中一段连续的数组
+template <typename T>
+struct MeshCacheSection
+{
+    const T* data = nullptr;
+    uint32_t count = 0;
+};
+
+// 写缓存时指向网格自己的数组, 读缓存时指向映射的文件
+struct MeshCacheData
+{
+    Bounds3 bounds;
+    float area = 0;
+    MeshCacheSection<Vector3f> positions;       // 共用的顶点
+    MeshCacheSection<uint32_t> indices;         // 每个三角形 3 个顶点下标, BVH 叶子的顺序
+    MeshCacheSection<int32_t> faceOrder;        // 叶子顺序的第 i 个三角形是 OBJ 中的第几个面
+    MeshCacheSection<LinearBVHNode> nodes;
+    MeshCacheSection<WideBVHNode<4>> wideNodes4;
+    MeshCacheSection<WideBVHNode<8>> wideNodes8;
+    MeshCacheSection<TriangleBlock<4>> blocks4;
+    MeshCacheSection<TriangleBlock<8>> blocks8;
+};
+
+// 整个文件的 FNV-1a 哈希, 读不了文件时返回 false
+bool HashFile(const std::string& filename, uint64_t& hash);
+
+// 缓存文件名, 放在源文件旁边. 文件名里带建树参数的摘要, 不同参数的缓存各用各的文件,
+// 交替用不同参数渲染时不会互相覆盖. 源文件的哈希不在文件名里, 源文件改了就原地重写
+std::string MeshCachePath(const std::string& sourceFile, const MeshCacheKey& key);
+
+// 文件格式: 固定长度的文件头, 后面是各段数组, 每段从 64 字节对齐的位置开始,
+// 映射后可以直接当数组用. 文件头记录版本号, 各结构体的大小和 key, 不一致时当作没有缓存.
+// 先写到带进程号的临时文件再改名, 同时写同一个缓存的进程不会截断彼此的文件,
+// 也不会读到写了一半的文件
+bool WriteMeshCache(const std::string& filename, const MeshCacheKey& key, const MeshCacheData& data);
+
+// 映射 filename 并检查文件头和 BVH 节点引用的下标, 成功时 data 的各段指向 file 的内容,
+// file 需要一直保留
+bool ReadMeshCache(const std::string& filename, const MeshCacheKey& key, MappedFile& file,
+                   MeshCacheData& data);
+
+#endif //RAYTRACING_MESHCACHE_H
@@ -0,0 +1,272 @@
+//
+// Streaming Wavefront OBJ parser: memory-maps the file and parses chunks of
+// it in parallel into indexed position/normal/uv arrays.
+//
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include "MappedFile.hpp"
+#include "ObjParser.hpp"
+#include "Parallel.hpp"
+
+namespace {
+
+enum LineType { kOther, kPosition, kNormal, kUV, kFace };
+
+// 文件中以换行结尾的一段, 两遍扫描的中间结果都放在这里
+struct Chunk
+{
+    const char* begin;
+    const char* end;
+    // 第一遍: 这一块里各种顶点的个数; 之后是前面所有块的个数之和
+    size_t count[4] = {};
+    size_t base[4] = {};
+    // 第二遍: 这一块的三角形, 合并时整段拷到结果里
+    std::vector<int> positionIndex, normalIndex, uvIndex;
+    const char* errorLine = nullptr;
+};
+
+struct Corner
+{
+    int position, uv, normal;
+};
+
+inline bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* SkipSpace(const char* p, const char* end)
+{
+    while (p < end && IsSpace(*p))
+        ++p;
+    return p;
+}
+
+// 跳过行首空白, 返回语句类型, p 指向关键字后面
+inline LineType Classify(const char*& p, const char* end)
+{
+    p = SkipSpace(p, end);
+    if (end - p < 2)
+        return kOther;
+    if (p[0] == 'v') {
+        if (IsSpace(p[1])) {
+            p += 1;
+            return kPosition;
+        }
+        if (end - p >= 3 && IsSpace(p[2])) {
+            if (p[1] == 'n') {
+                p += 2;
+                return kNormal;
+            }
+            if (p[1] == 't') {
+                p += 2;
+                return kUV;
+            }
+        }
+        return kOther;
+    }
+    if (p[0] == 'f' && IsSpace(p[1])) {
+        p += 1;
+        return kFace;
+    }
+    return kOther;
+}
+
+inline const char* LineEnd(const char* p, const char* end)
+{
+    const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    return newline ? newline : end;
+}
+
+bool ParseFloat(const char*& p, const char* end, float& value)
+{
+    p = SkipSpace(p, end);
+    if (p < end && *p == '+')
+        ++p;
+    std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+// OBJ 的索引从 1 开始, 负数表示从当前已有的顶点往回数. 转成从 0 开始的全局下标
+bool ParseIndex(const char*& p, const char* end, size_t current, int& index)
+{
+    int value;
+    std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc() || value == 0)
+        return false;
+    p = result.ptr;
+    long long absolute = value > 0 ? (long long)value - 1 : (long long)current + value;
+    if (absolute < 0)
+        return false;
+    index = (int)absolute;
+    return true;
+}
+
+// v, v/vt, v//vn 或 v/vt/vn
+bool ParseCorner(const char*& p, const char* end, const size_t current[4], Corner& corner)
+{
+    corner.uv = corner.normal = -1;
+    if (!ParseIndex(p, end, current[kPosition], corner.position))
+        return false;
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p != '/' && !ParseIndex(p, end, current[kUV], corner.uv))
+            return false;
+        if (p < end && *p == '/') {
+            ++p;
+            if (!ParseIndex(p, end, current[kNormal], corner.normal))
+                return false;
+        }
+    }
+    return p == end || IsSpace(*p);
+}
+
+// 只看行首关键字, 不解析数字
+void CountChunk(Chunk& chunk)
+{
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* lineEnd = LineEnd(line, chunk.end);
+        const char* p = line;
+        LineType type = Classify(p, lineEnd);
+        if (type != kOther && type != kFace)
+            ++chunk.count[type];
+        line = lineEnd + 1;
+    }
+}
+
+// 顶点直接写到结果数组中 base 开始的位置, 三角形先放在块里
+void ParseChunk(Chunk& chunk, ObjMesh& mesh)
+{
+    size_t current[4];
+    std::copy(chunk.base, chunk.base + 4, current);
+    // 多边形的顶点, 每块一个, 反复使用不再分配
+    std::vector<Corner> corners;
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* lineEnd = LineEnd(line, chunk.end);
+        const char* p = line;
+        bool ok = true;
+        switch (Classify(p, lineEnd)) {
+        case kPosition: {
+            Vector3f& v = mesh.positions[current[kPosition]++];
+            ok = ParseFloat(p, lineEnd, v.x) && ParseFloat(p, lineEnd, v.y) && ParseFloat(p, lineEnd, v.z);
+            break;
+        }
+        case kNormal: {
+            Vector3f& n = mesh.normals[current[kNormal]++];
+            ok = ParseFloat(p, lineEnd, n.x) && ParseFloat(p, lineEnd, n.y) && ParseFloat(p, lineEnd, n.z);
+            break;
+        }
+        case kUV: {
+            Vector2f& uv = mesh.uvs[current[kUV]++];
+            ok = ParseFloat(p, lineEnd, uv.x) && ParseFloat(p, lineEnd, uv.y);
+            break;
+        }
+        case kFace: {
+            corners.clear();
+            for (p = SkipSpace(p, lineEnd); ok && p < lineEnd; p = SkipSpace(p, lineEnd)) {
+                Corner corner;
+                ok = ParseCorner(p, lineEnd, current, corner);
+                corners.push_back(corner);
+            }
+            ok = ok && corners.size() >= 3;
+            for (size_t i = 1; ok && i + 1 < corners.size(); ++i) {
+                for (const Corner& c : { corners[0], corners[i], corners[i + 1] }) {
+                    chunk.positionIndex.push_back(c.position);
+                    chunk.uvIndex.push_back(c.uv);
+                    chunk.normalIndex.push_back(c.normal);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        if (!ok) {
+            chunk.errorLine = line;
+            return;
+        }
+        line = lineEnd + 1;
+    }
+}
+
+bool CheckRange(const std::vector<int>& indices, size_t count)
+{
+    for (int index : indices) {
+        if (index >= (int)count)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool ParseObj(const std::string& filename, ObjMesh& mesh, std::string& error, int nThreads)
+{
+    mesh = ObjMesh();
+    MappedFile file;
+    if (!file.Open(filename)) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const char* end = data + file.size();
+
+    // 块的数量是线程数的几倍, 让 ParallelFor 能平衡负载; 小文件只切一块
+    if (nThreads <= 0)
+        nThreads = NumSystemCores();
+    size_t chunkSize = std::max<size_t>(1 << 20, file.size() / (nThreads * 4));
+    std::vector<Chunk> chunks;
+    for (const char* p = data; p < end;) {
+        const char* lineEnd = LineEnd(p + std::min(chunkSize, (size_t)(end - p)), end);
+        Chunk chunk;
+        chunk.begin = p;
+        chunk.end = lineEnd < end ? lineEnd + 1 : end;
+        chunks.push_back(std::move(chunk));
+        p = chunks.back().end;
+    }
+    int nChunks = (int)chunks.size();
+
+    ParallelFor(nChunks, [&](int c, int) { CountChunk(chunks[c]); }, nThreads);
+    size_t total[4] = {};
+    for (Chunk& chunk : chunks) {
+        for (int t = 0; t < 4; ++t) {
+            chunk.base[t] = total[t];
+            total[t] += chunk.count[t];
+        }
+    }
+    mesh.positions.resize(total[kPosition]);
+    mesh.normals.resize(total[kNormal]);
+    mesh.uvs.resize(total[kUV]);
+
+    ParallelFor(nChunks, [&](int c, int) { ParseChunk(chunks[c], mesh); }, nThreads);
+    for (const Chunk& chunk : chunks) {
+        if (chunk.errorLine) {
+            const char* lineEnd = LineEnd(chunk.errorLine, end);
+            error = filename + ": malformed line \"" + std::string(chunk.errorLine, lineEnd) + "\"";
+            return false;
+        }
+    }
+
+    // 各块的三角形按文件顺序拼起来
+    std::vector<size_t> offset(nChunks + 1, 0);
+    for (int c = 0; c < nChunks; ++c)
+        offset[c + 1] = offset[c] + chunks[c].positionIndex.size();
+    mesh.positionIndex.resize(offset[nChunks]);
+    mesh.normalIndex.resize(offset[nChunks]);
+    mesh.uvIndex.resize(offset[nChunks]);
+    ParallelFor(nChunks, [&](int c, int) {
+        const Chunk& chunk = chunks[c];
+        std::copy(chunk.positionIndex.begin(), chunk.positionIndex.end(), mesh.positionIndex.begin() + offset[c]);
+        std::copy(chunk.normalIndex.begin(), chunk.normalIndex.end(), mesh.normalIndex.begin() + offset[c]);
+        std::copy(chunk.uvIndex.begin(), chunk.uvIndex.end(), mesh.uvIndex.begin() + offset[c]);
+    }, nThreads);
+    bool inRange = CheckRange(mesh.positionIndex, total[kPosition]) && CheckRange(mesh.normalIndex, total[kNormal])
+        && CheckRange(mesh.uvIndex, total[kUV]);
+    if (!inRange) {
+        error = filename + ": face index out of range";
+        return false;
+    }
+    return true;
+}
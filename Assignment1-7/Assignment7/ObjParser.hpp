@@ -0,0 +1,30 @@
+//
+// Streaming Wavefront OBJ parser: memory-maps the file and parses chunks of
+// it in parallel into indexed position/normal/uv arrays.
+//
+
+#ifndef RAYTRACING_OBJPARSER_H
+#define RAYTRACING_OBJPARSER_H
+
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+// 解析出的三角形网格. 索引从 0 开始, 每个三角形占三项, 顺序与文件中的面相同;
+// 多于三个顶点的面按扇形拆成三角形. 面没有给出法线或纹理坐标时对应的索引为 -1
+struct ObjMesh
+{
+    std::vector<Vector3f> positions;
+    std::vector<Vector3f> normals;
+    std::vector<Vector2f> uvs;
+    std::vector<int> positionIndex, normalIndex, uvIndex;
+
+    size_t TriangleCount() const { return positionIndex.size() / 3; }
+};
+
+// 只处理 v, vn, vt 和 f, 其他语句 (o, g, s, usemtl, mtllib ...) 忽略.
+// 文件被切成以换行结尾的若干块, 先并行数每块的顶点数确定全局编号, 再并行解析.
+// 文件打不开或格式错误时在 error 中写明原因并返回 false
+bool ParseObj(const std::string& filename, ObjMesh& mesh, std::string& error, int nThreads = 0);
+
+#endif //RAYTRACING_OBJPARSER_H
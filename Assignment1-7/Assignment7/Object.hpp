@@ -10,12 +10,14 @@
 #include "Bounds3.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
+#include "Sampler.hpp"
 
 class Object
 {
 public:
     Object() {}
     virtual ~Object() {}
+    // 遮挡查询: 在 [0, ray.t_max) 内是否与物体相交
     virtual bool intersect(const Ray& ray) = 0;
     virtual bool intersect(const Ray& ray, float &, uint32_t &) const = 0;
     virtual Intersection getIntersection(Ray _ray) = 0;
@@ -23,8 +25,33 @@ public:
     virtual Vector3f evalDiffuseColor(const Vector2f &) const =0;
     virtual Bounds3 getBounds()=0;
     virtual float getArea()=0;
-    virtual void Sample(Intersection &pos, float &pdf)=0;
+    virtual void Sample(Intersection &pos, float &pdf, Sampler &sampler)=0;
     virtual bool hasEmit()=0;
+
+    // 光线包求交, activeMask 的第 i 位表示 rays[i] 参与求交. hits[i] 中已有交点的距离
+    // 就是这条光线的 tMax, 只有更近的交点才会覆盖它. 默认实现逐条调用 getIntersection.
+    virtual void getIntersectionPacket(const Ray* rays, int count, uint32_t activeMask, Intersection* hits)
+    {
+        for (int i = 0; i < count; ++i) {
+            if (!(activeMask & (1u << i)))
+                continue;
+            Ray ray = rays[i];
+            ray.t_max = std::min(ray.t_max, hits[i].distance);
+            Intersection hit = getIntersection(ray);
+            if (hit.happened && hit.distance < hits[i].distance)
+                hits[i] = hit;
+        }
+    }
+    // 光线包遮挡查询, 返回被挡住的光线的掩码. 默认实现逐条调用 intersect
+    virtual uint32_t intersectPacketP(const Ray* rays, int count, uint32_t activeMask)
+    {
+        uint32_t occluded = 0;
+        for (int i = 0; i < count; ++i) {
+            if ((activeMask & (1u << i)) && intersect(rays[i]))
+                occluded |= 1u << i;
+        }
+        return occluded;
+    }
 };
 
 
@@ -0,0 +1,98 @@
+//
+// Work-stealing parallel loop used by the renderer.
+//
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Parallel.hpp"
+
+namespace {
+
+// 每个线程一个任务队列, 自己从头部取, 别人从尾部偷
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+
+    bool PopFront(int& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+            return false;
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+
+    bool StealBack(int& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+            return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+};
+
+} // namespace
+
+int NumSystemCores()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(int count, const std::function<void(int, int)>& func, int nThreads)
+{
+    if (count <= 0)
+        return;
+    if (nThreads <= 0)
+        nThreads = NumSystemCores();
+    nThreads = std::min(nThreads, count);
+
+    if (nThreads == 1) {
+        for (int i = 0; i < count; ++i)
+            func(i, 0);
+        return;
+    }
+
+    // 按连续区间预先分配, 相邻的任务留在同一线程上以保持局部性
+    std::vector<std::unique_ptr<WorkQueue>> queues(nThreads);
+    for (int t = 0; t < nThreads; ++t) {
+        queues[t] = std::make_unique<WorkQueue>();
+        int begin = (int)((long long)count * t / nThreads);
+        int end = (int)((long long)count * (t + 1) / nThreads);
+        for (int i = begin; i < end; ++i)
+            queues[t]->tasks.push_back(i);
+    }
+
+    auto worker = [&](int threadIndex) {
+        int task;
+        while (true) {
+            if (queues[threadIndex]->PopFront(task)) {
+                func(task, threadIndex);
+                continue;
+            }
+            // 自己的队列空了, 依次尝试从其他线程窃取
+            bool stolen = false;
+            for (int k = 1; k < nThreads && !stolen; ++k) {
+                int victim = (threadIndex + k) % nThreads;
+                stolen = queues[victim]->StealBack(task);
+            }
+            if (!stolen)
+                return;
+            func(task, threadIndex);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (int t = 1; t < nThreads; ++t)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+}
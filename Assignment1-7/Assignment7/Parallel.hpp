@@ -0,0 +1,20 @@
+//
+// Work-stealing parallel loop used by the renderer.
+//
+
+#ifndef RAYTRACING_PARALLEL_H
+#define RAYTRACING_PARALLEL_H
+
+#include <functional>
+
+// 返回可用的硬件线程数, 至少为 1
+int NumSystemCores();
+
+// 把 [0, count) 的任务分给 nThreads 个线程执行, 调用线程会阻塞直到全部完成.
+// 每个线程先按顺序处理分给自己的一段任务, 做完后从其他线程队列的尾部窃取,
+// 这样耗时不均的任务(比如噪点多的 tile)不会让线程空等.
+// func 的第二个参数是线程编号 [0, nThreads), 方便调用者维护每线程的数据.
+void ParallelFor(int count, const std::function<void(int index, int threadIndex)>& func,
+                 int nThreads = 0);
+
+#endif //RAYTRACING_PARALLEL_H
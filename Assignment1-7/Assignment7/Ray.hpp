@@ -12,6 +12,8 @@ struct Ray{
     double t;//transportation time,
     double t_min, t_max;
 
+    // 只给需要先占位的光线数组用
+    Ray() : Ray(Vector3f(), Vector3f(0, 0, 1)) {}
     Ray(const Vector3f& ori, const Vector3f& dir, const double _t = 0.0): origin(ori), direction(dir),t(_t) {
         direction_inv = Vector3f(1./direction.x, 1./direction.y, 1./direction.z);
         t_min = 0.0;
@@ -26,4 +28,14 @@ struct Ray{
         return os;
     }
 };
+
+// 遍历 BVH 时只记下最近的交点是哪个图元和它的重心坐标. 位置, 法线和材质这些
+// 要等遍历完, 只为最终的最近交点算一次 (BVHLeafIntersector::ComputeIntersection)
+struct HitRecord
+{
+    float t = std::numeric_limits<float>::infinity();
+    float u = 0, v = 0;     // 重心坐标, 交点 = (1 - u - v) * v0 + u * v1 + v * v2
+    int index = -1;         // 图元的下标, 没有交点时为 -1
+};
+
 #endif //RAYTRACING_RAY_H
@@ -4,56 +4,340 @@
 // Created by goksu on 2/25/20.
 //
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <mutex>
 #include "Scene.hpp"
 #include "Renderer.hpp"
+#include "Wavefront.hpp"
+#include "Checkpoint.hpp"
+#include "Denoiser.hpp"
+#include "Parallel.hpp"
+#include "Stats.hpp"
 
 
-inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
-
 const float EPSILON = 0.00001;
 
-// The main render function. This where we iterate over all pixels in the image,
-// generate primary rays and cast these rays into the scene. The content of the
-// framebuffer is saved to a file.
-void Renderer::Render(const Scene& scene)
-{
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
-
-    float scale = tan(deg2rad(scene.fov * 0.5));
-    float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
-    int m = 0;
-
-    // change the spp value to change sample ammount
-    int spp = 16;
-    std::cout << "SPP: " << spp << "\n";
-    for (uint32_t j = 0; j < scene.height; ++j) {
-        for (uint32_t i = 0; i < scene.width; ++i) {
-            // generate primary ray direction
-            float x = (2 * (i + 0.5) / (float)scene.width - 1) *
-                      imageAspectRatio * scale;
-            float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
-
-            Vector3f dir = normalize(Vector3f(-x, y, 1));
-            for (int k = 0; k < spp; k++){
-                framebuffer[m] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
+Camera::Camera(const Scene& scene)
+    : eye_pos(278, 273, -800), scale(tan(deg2rad(scene.fov * 0.5))),
+      imageAspectRatio(scene.width / (float)scene.height), width(scene.width), height(scene.height)
+{
+}
+
+Ray Camera::GenerateRay(int i, int j, const Vector2f& jitter) const
+{
+    float x = (2 * (i + jitter.x) / (float)width - 1) * imageAspectRatio * scale;
+    float y = (1 - 2 * (j + jitter.y) / (float)height) * scale;
+    return Ray(eye_pos, normalize(Vector3f(-x, y, 1)));
+}
+
+// 写 8 位 PPM, color(m) 返回第 m 个像素 [0, 1] 内的显示颜色
+template <typename F>
+static void WriteImage(const char* filename, int width, int height, F color)
+{
+    FILE* fp = fopen(filename, "wb");
+    (void)fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    for (auto i = 0; i < height * width; ++i) {
+        Vector3f c = color(i);
+        unsigned char rgb[3];
+        rgb[0] = (unsigned char)(255 * clamp(0, 1, c.x));
+        rgb[1] = (unsigned char)(255 * clamp(0, 1, c.y));
+        rgb[2] = (unsigned char)(255 * clamp(0, 1, c.z));
+        fwrite(rgb, 1, 3, fp);
+    }
+    fclose(fp);
+}
+
+// 截断到 [0, 1] 后做 0.6 次方的 gamma
+static Vector3f ToDisplay(const Vector3f& c)
+{
+    return Vector3f(std::pow(clamp(0, 1, c.x), 0.6f),
+                    std::pow(clamp(0, 1, c.y), 0.6f),
+                    std::pow(clamp(0, 1, c.z), 0.6f));
+}
+
+// Render up to nSamples more samples for every active pixel of one tile
+// [x0, x1) x [y0, y1) and add them to the film; a pixel never goes past options.spp.
+// Every sample restarts the sampler from its (pixel, sample index) pair, so the
+// image does not depend on which thread ran the tile, in which order tiles were
+// finished, or how the samples were split into passes.
+void Renderer::RenderTile(const Scene& scene, int x0, int y0, int x1, int y1,
+                          int nSamples, Film& film) const
+{
+    Camera camera(scene);
+    Sampler sampler(options.sampler, options.seed);
+
+    for (int j = y0; j < y1; ++j) {
+        for (int i = x0; i < x1; ++i) {
+            int m = j * scene.width + i;
+            if (!film.active[m])
+                continue;
+            int firstSample = (int)film.stats[m].n;
+            int endSample = std::min(firstSample + nSamples, options.spp);
+            for (int k = firstSample; k < endSample; k++){
+                sampler.StartPixelSample(m, k);
+
+                // generate primary ray direction, jittered inside the pixel
+                Vector2f jitter = sampler.Get2D();
+                AOVSample aov;
+                film.AddSample(m, scene.castRay(camera.GenerateRay(i, j, jitter), 0, sampler,
+                                                film.HasAOVs() ? &aov : nullptr));
+                if (film.HasAOVs())
+                    film.AddAOV(m, aov);
+            }
+        }
+    }
+}
+
+// Same as RenderTile, but the tile is walked in 4x4 pixel blocks and each
+// sample of a block is traced as one ray packet. Samples are added to every
+// pixel in the same order, so the result matches RenderTile exactly.
+void Renderer::RenderTilePackets(const Scene& scene, int x0, int y0, int x1, int y1,
+                                 int nSamples, Film& film) const
+{
+    const int packetSize = 4;
+    Camera camera(scene);
+
+    Sampler samplers[kMaxPacketSize];
+    int pixels[kMaxPacketSize];
+    int firstSample[kMaxPacketSize];
+    Vector3f radiance[kMaxPacketSize];
+    AOVSample aovs[kMaxPacketSize];
+    std::vector<Ray> rays;
+    rays.reserve(kMaxPacketSize);
+    for (int by = y0; by < y1; by += packetSize) {
+        for (int bx = x0; bx < x1; bx += packetSize) {
+            // 块内各像素已有的样本数可能不同, 先记下来
+            for (int j = by; j < std::min(by + packetSize, y1); ++j) {
+                for (int i = bx; i < std::min(bx + packetSize, x1); ++i) {
+                    int m = j * scene.width + i;
+                    firstSample[(j - by) * packetSize + (i - bx)] = (int)film.stats[m].n;
+                }
+            }
+            for (int k = 0; k < nSamples; k++) {
+                rays.clear();
+                for (int j = by; j < std::min(by + packetSize, y1); ++j) {
+                    for (int i = bx; i < std::min(bx + packetSize, x1); ++i) {
+                        int m = j * scene.width + i;
+                        int sampleIndex = firstSample[(j - by) * packetSize + (i - bx)] + k;
+                        if (!film.active[m] || sampleIndex >= options.spp)
+                            continue;
+                        int n = (int)rays.size();
+                        pixels[n] = m;
+                        samplers[n] = Sampler(options.sampler, options.seed);
+                        samplers[n].StartPixelSample(m, sampleIndex);
+
+                        Vector2f jitter = samplers[n].Get2D();
+                        rays.push_back(camera.GenerateRay(i, j, jitter));
+                    }
+                }
+                if (rays.empty())
+                    break;
+                scene.castRayPacket(rays.data(), (int)rays.size(), samplers, radiance,
+                                    film.HasAOVs() ? aovs : nullptr);
+                for (int n = 0; n < (int)rays.size(); ++n) {
+                    film.AddSample(pixels[n], radiance[n]);
+                    if (film.HasAOVs())
+                        film.AddAOV(pixels[n], aovs[n]);
+                }
             }
-            m++;
         }
-        UpdateProgress(j / (float)scene.height);
     }
+}
+
+// Render up to nSamples more samples for every active pixel and add them to the film.
+void Renderer::RenderPass(const Scene& scene, int nSamples, Film& film) const
+{
+    int nThreads = options.threads > 0 ? options.threads : NumSystemCores();
+    if (options.integrator == IntegratorType::WAVEFRONT) {
+        WavefrontIntegrator(scene, options).Render(film, nSamples);
+        return;
+    }
+
+    int tileSize = std::max(1, options.tileSize);
+    int nTilesX = (scene.width + tileSize - 1) / tileSize;
+    int nTilesY = (scene.height + tileSize - 1) / tileSize;
+    int nTiles = nTilesX * nTilesY;
+
+    // 各线程完成 tile 后累加计数, 抢到锁的线程负责刷新进度条
+    std::atomic<int> tilesDone{0};
+    std::mutex progressMutex;
+    UpdateProgress(0.f);
+    ParallelFor(nTiles, [&](int tile, int) {
+        int x0 = (tile % nTilesX) * tileSize;
+        int y0 = (tile / nTilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, scene.width);
+        int y1 = std::min(y0 + tileSize, scene.height);
+        if (options.packets)
+            RenderTilePackets(scene, x0, y0, x1, y1, nSamples, film);
+        else
+            RenderTile(scene, x0, y0, x1, y1, nSamples, film);
+
+        ++tilesDone;
+        std::unique_lock<std::mutex> lock(progressMutex, std::try_to_lock);
+        if (lock.owns_lock())
+            UpdateProgress(tilesDone.load() / (float)nTiles);
+    }, nThreads);
     UpdateProgress(1.f);
+}
+
+// Mark the pixels that still need samples and return how many there are. Without
+// adaptive sampling that is every pixel below options.spp; with it, pixels also
+// stop once their relative error drops below the threshold.
+int Renderer::UpdateActivePixels(Film& film) const
+{
+    bool adaptive = options.adaptiveThreshold > 0;
+    int width = film.width, height = film.height;
+    std::vector<float> error;
+    if (adaptive) {
+        error.resize(width * height);
+        for (int m = 0; m < width * height; ++m)
+            error[m] = film.stats[m].RelativeError();
+    }
+
+    int nActive = 0;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            int m = j * width + i;
+            const PixelStats& stats = film.stats[m];
+            bool active = (int)stats.n < options.spp;
+            if (active && adaptive && (int)stats.n >= options.adaptiveMinSpp) {
+                // 样本少时方差估计本身很不准, 偶尔没采到亮样本的像素会被误判为收敛.
+                // 用 3x3 邻域里最大的误差, 邻近像素的噪声分布差不多, 能把这种像素救回来
+                float maxError = 0;
+                for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); ++y)
+                    for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); ++x)
+                        maxError = std::max(maxError, error[y * width + x]);
+                active = maxError > options.adaptiveThreshold;
+            }
+            film.active[m] = active;
+            nActive += active;
+        }
+    }
+    return nActive;
+}
+
+// The main render function. The image is rendered in passes of passSpp samples;
+// after every pass the float accumulation buffer goes to the checkpoint file and
+// the current average to binary.ppm, so a killed render can be resumed.
+bool Renderer::Render(const Scene& scene)
+{
+    Film film(scene.width, scene.height);
+
+    if (options.resume) {
+        CheckpointHeader header;
+        if (!LoadCheckpoint(options.checkpoint, header, film)) {
+            std::cerr << "Cannot read checkpoint " << options.checkpoint << "\n";
+            return false;
+        }
+        if (header.width != scene.width || header.height != scene.height) {
+            std::cerr << "Checkpoint " << options.checkpoint << " is " << header.width << "x" << header.height
+                      << ", scene is " << scene.width << "x" << scene.height << "\n";
+            return false;
+        }
+        // 接着原来的随机序列往后取样本, 否则新样本会和已有的重复
+        options.seed = header.seed;
+        options.sampler = (SamplerType)header.sampler;
+        std::cout << "Resuming " << options.checkpoint << " at " << header.spp << " spp\n";
+        if ((options.aovs || options.denoise) && !film.HasAOVs() && header.spp > 0) {
+            std::cerr << "Checkpoint " << options.checkpoint << " has no AOVs, AOV output and denoising are off\n";
+            options.aovs = options.denoise = false;
+        }
+    }
+    if ((options.aovs || options.denoise) && !film.HasAOVs())
+        film.EnableAOVs();
+
+    bool adaptive = options.adaptiveThreshold > 0;
+    int nThreads = options.threads > 0 ? options.threads : NumSystemCores();
+    // 自适应采样默认每遍 adaptiveMinSpp 个样本, 每遍之后重新挑选没收敛的像素
+    int passSpp = options.passSpp > 0 ? options.passSpp
+                : adaptive ? std::max(1, options.adaptiveMinSpp) : std::max(1, options.spp);
+    std::cout << "SPP: " << options.spp << ", sampler: "
+              << (options.sampler == SamplerType::SOBOL ? "sobol" : "pcg") << "\n";
+    if (adaptive)
+        std::cout << "Adaptive sampling: relative error " << options.adaptiveThreshold
+                  << ", min spp " << options.adaptiveMinSpp << "\n";
+    if (options.integrator == IntegratorType::WAVEFRONT)
+        std::cout << "Threads: " << nThreads << ", wavefront integrator\n";
+    else
+        std::cout << "Threads: " << nThreads << ", tile size: " << options.tileSize
+                  << (options.packets ? ", 4x4 ray packets" : "") << "\n";
+
+#ifdef RAYTRACING_STATS
+    ResetStats();
+    auto renderStart = std::chrono::steady_clock::now();
+#endif
+    bool rendered = false;
+    int nPixels = scene.width * scene.height;
+    for (int nActive; (nActive = UpdateActivePixels(film)) > 0; ) {
+        if (passSpp < options.spp)
+            std::cout << "Pass: " << nActive << " / " << nPixels << " pixels, " << passSpp << " spp\n";
+        RenderPass(scene, passSpp, film);
+
+        if (!options.checkpoint.empty()) {
+            CheckpointHeader header;
+            header.seed = options.seed;
+            header.sampler = (uint32_t)options.sampler;
+            if (!SaveCheckpoint(options.checkpoint, header, film))
+                std::cerr << "\nCannot write checkpoint " << options.checkpoint << "\n";
+        }
+        WriteFramebuffer(film);
+        std::cout << "\n";
+        rendered = true;
+    }
+    // 检查点里的样本已经够了, 只重新输出图像
+    if (!rendered)
+        WriteFramebuffer(film);
+#ifdef RAYTRACING_STATS
+    double renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+    if (!WriteStatsReport("stats.json", renderSeconds))
+        std::cerr << "Cannot write stats.json\n";
+#endif
+
+    if (options.denoise) {
+        auto start = std::chrono::steady_clock::now();
+        DenoiserOptions denoiserOptions;
+        denoiserOptions.threads = nThreads;
+        std::vector<Vector3f> denoised = Denoise(film, denoiserOptions);
+        WriteImage("denoised.ppm", film.width, film.height, [&](int m) { return ToDisplay(denoised[m]); });
+        auto stop = std::chrono::steady_clock::now();
+        std::cout << "Denoised in " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms\n";
+    }
 
-    // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
-        color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
-        color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
-        color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
-        fwrite(color, 1, 3, fp);
-    }
-    fclose(fp);    
+    if (adaptive) {
+        uint64_t totalSamples = 0;
+        for (const PixelStats& stats : film.stats)
+            totalSamples += stats.n;
+        std::cout << "Average spp: " << totalSamples / (double)nPixels << "\n";
+    }
+    return true;
+}
+
+// save the average of the accumulated samples to file
+void Renderer::WriteFramebuffer(const Film& film) const
+{
+    WriteImage("binary.ppm", film.width, film.height, [&](int m) { return ToDisplay(film.Average(m)); });
+
+    // 每个像素的样本数, 从黑 (0) 经红到黄 (options.spp)
+    if (options.adaptiveThreshold > 0) {
+        WriteImage("samples.ppm", film.width, film.height, [&](int m) {
+            float t = film.stats[m].n / (float)std::max(1, options.spp);
+            return Vector3f(2 * t, 2 * t - 1, 0);
+        });
+    }
+
+    // 反照率, 法线 (映射到 [0, 1]) 和按最远距离归一化的深度
+    if (options.aovs) {
+        float maxDepth = 0;
+        for (int m = 0; m < film.width * film.height; ++m)
+            maxDepth = std::max(maxDepth, film.AverageAOV(m).depth);
+        WriteImage("albedo.ppm", film.width, film.height, [&](int m) { return film.AverageAOV(m).albedo; });
+        WriteImage("normal.ppm", film.width, film.height, [&](int m) {
+            return film.AverageAOV(m).normal * 0.5f + Vector3f(0.5f);
+        });
+        WriteImage("depth.ppm", film.width, film.height, [&](int m) {
+            return Vector3f(maxDepth > 0 ? film.AverageAOV(m).depth / maxDepth : 0.0f);
+        });
+    }
 }
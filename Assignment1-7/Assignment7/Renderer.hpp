@@ -1,7 +1,9 @@
 //
 // Created by goksu on 2/25/20.
 //
+#include <string>
 #include "Scene.hpp"
+#include "Film.hpp"
 
 #pragma once
 struct hit_payload
@@ -12,10 +14,56 @@ struct hit_payload
     Object* hit_obj;
 };
 
+enum class IntegratorType { RECURSIVE, WAVEFRONT };
+
+struct RenderOptions
+{
+    int spp = 16;
+    int threads = 0;        // 0 表示使用全部硬件线程
+    int tileSize = 16;
+    uint32_t seed = 0;
+    SamplerType sampler = SamplerType::SOBOL;
+    bool packets = true;    // 相机光线按 4x4 像素的光线包求交
+    IntegratorType integrator = IntegratorType::RECURSIVE;
+    int passSpp = 0;        // 每一遍渲染的 spp, 0 表示一遍渲完
+    std::string checkpoint; // 每遍结束后写累积缓冲的文件, 空表示不写
+    bool resume = false;    // 从 checkpoint 读入已有的样本接着渲
+    // 自适应采样: 像素至少取 adaptiveMinSpp 个样本, 之后均值的相对误差低于
+    // adaptiveThreshold 就不再采样, 最多取 spp 个. 阈值为 0 表示关闭
+    float adaptiveThreshold = 0;
+    int adaptiveMinSpp = 8;
+    bool aovs = false;      // 输出第一个交点的反照率, 法线和深度 (albedo/normal/depth.ppm)
+    bool denoise = false;   // 渲染完后用 AOV 引导的滤波去噪, 输出 denoised.ppm
+};
+
+// 针孔相机, 位于 (278, 273, -800) 看向 +z
+struct Camera
+{
+    explicit Camera(const Scene& scene);
+
+    // 像素 (i, j) 内偏移 jitter 处的相机光线
+    Ray GenerateRay(int i, int j, const Vector2f& jitter) const;
+
+    Vector3f eye_pos;
+    float scale;
+    float imageAspectRatio;
+    int width, height;
+};
+
 class Renderer
 {
 public:
-    void Render(const Scene& scene);
+    explicit Renderer(const RenderOptions& options = RenderOptions()) : options(options) {}
+
+    // 读检查点失败时返回 false
+    bool Render(const Scene& scene);
+
+    RenderOptions options;
 
 private:
+    void RenderPass(const Scene& scene, int nSamples, Film& film) const;
+    void RenderTile(const Scene& scene, int x0, int y0, int x1, int y1, int nSamples, Film& film) const;
+    void RenderTilePackets(const Scene& scene, int x0, int y0, int x1, int y1, int nSamples, Film& film) const;
+    int UpdateActivePixels(Film& film) const;
+    void WriteFramebuffer(const Film& film) const;
 };
@@ -0,0 +1,162 @@
+//
+// Per-pixel deterministic samplers for the path tracer.
+//
+
+#ifndef RAYTRACING_SAMPLER_H
+#define RAYTRACING_SAMPLER_H
+
+#include <cstdint>
+#include "Vector.hpp"
+
+enum class SamplerType { PCG, SOBOL };
+
+// 把整数打散成均匀分布的种子 (murmur3 finalizer)
+inline uint32_t mix_bits(uint32_t v)
+{
+    v ^= v >> 16;
+    v *= 0x85ebca6bu;
+    v ^= v >> 13;
+    v *= 0xc2b2ae35u;
+    v ^= v >> 16;
+    return v;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v)
+{
+    return mix_bits(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// [0, 1) 内的 float, 只用高 24 位保证不会取到 1
+inline float uint_to_float(uint32_t v)
+{
+    return (v >> 8) * 0x1p-24f;
+}
+
+// PCG32 (O'Neill 2014), 每个 (像素, 样本) 选一条独立的流
+class PCG32
+{
+public:
+    PCG32() { SetSequence(0, 0x853c49e6748fea9bULL); }
+
+    void SetSequence(uint64_t sequence, uint64_t seed)
+    {
+        state = 0u;
+        inc = (sequence << 1u) | 1u;
+        UniformUInt32();
+        state += seed;
+        UniformUInt32();
+    }
+
+    uint32_t UniformUInt32()
+    {
+        uint64_t oldState = state;
+        state = oldState * 0x5851f42d4c957f2dULL + inc;
+        uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+        uint32_t rot = (uint32_t)(oldState >> 59u);
+        return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+    }
+
+    float UniformFloat() { return uint_to_float(UniformUInt32()); }
+
+private:
+    uint64_t state, inc;
+};
+
+// 基于哈希的 Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling")
+namespace sobol {
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// Sobol 的前两维: 第 0 维是 van der Corput, 第 1 维的方向数满足 v[i+1] = v[i] ^ (v[i] >> 1)
+inline uint32_t sample_dim0(uint32_t index) { return reverse_bits(index); }
+
+inline uint32_t sample_dim1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1)
+            result ^= v;
+    return result;
+}
+
+} // namespace sobol
+
+// Sampler 是一个很小的值类型, 可以直接拷贝给每个线程或每条光线.
+// 调用 StartPixelSample 之后, 得到的随机数只由 (seed, 像素, 样本号, 维度) 决定,
+// 与线程数和渲染顺序无关.
+class Sampler
+{
+public:
+    explicit Sampler(SamplerType type = SamplerType::PCG, uint32_t seed = 0)
+        : type(type), seed(seed) {}
+
+    SamplerType Type() const { return type; }
+
+    void StartPixelSample(uint32_t pixelIndex, uint32_t index)
+    {
+        pixelSeed = hash_combine(seed, pixelIndex);
+        sampleIndex = index;
+        dimension = 0;
+        if (type == SamplerType::PCG)
+            rng.SetSequence(pixelSeed, mix_bits(index) ^ ((uint64_t)index << 32));
+    }
+
+    float Get1D()
+    {
+        if (type == SamplerType::PCG)
+            return rng.UniformFloat();
+        // 每一维都用自己的 seed 打乱样本顺序, 避免维度之间相关
+        uint32_t dimSeed = hash_combine(pixelSeed, dimension++);
+        uint32_t index = sobol::nested_uniform_scramble(sampleIndex, dimSeed);
+        return uint_to_float(sobol::nested_uniform_scramble(sobol::sample_dim0(index),
+                                                            hash_combine(dimSeed, 0)));
+    }
+
+    Vector2f Get2D()
+    {
+        if (type == SamplerType::PCG) {
+            float u = rng.UniformFloat();
+            return Vector2f(u, rng.UniformFloat());
+        }
+        uint32_t dimSeed = hash_combine(pixelSeed, dimension);
+        dimension += 2;
+        uint32_t index = sobol::nested_uniform_scramble(sampleIndex, dimSeed);
+        return Vector2f(
+            uint_to_float(sobol::nested_uniform_scramble(sobol::sample_dim0(index),
+                                                         hash_combine(dimSeed, 0))),
+            uint_to_float(sobol::nested_uniform_scramble(sobol::sample_dim1(index),
+                                                         hash_combine(dimSeed, 1))));
+    }
+
+private:
+    SamplerType type;
+    uint32_t seed;
+    uint32_t pixelSeed = 0;
+    uint32_t sampleIndex = 0;
+    uint32_t dimension = 0;
+    PCG32 rng;
+};
+
+#endif //RAYTRACING_SAMPLER_H
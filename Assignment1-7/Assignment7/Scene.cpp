@@ -5,36 +5,98 @@
 #include "Scene.hpp"
 
 
-void Scene::buildBVH() {
+void Scene::buildBVH(int maxPrimsInNode, BVHAccel::SplitMethod splitMethod,
+                     BVHAccel::TreeWidth treeWidth) {
     printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    this->bvh.reset(new BVHAccel(objects, maxPrimsInNode, splitMethod, treeWidth));
+    buildLights();
 }
 
-Intersection Scene::intersect(const Ray& ray) const
+void Scene::updateBVH()
 {
-    return this->bvh->Intersect(ray);
+    if (!this->bvh)
+        return;
+    this->bvh->Update();
+    // 发光物体的面积可能变了
+    buildLights();
 }
 
-
-void Scene::sampleLight(Intersection& pos, float& pdf) const
+void Scene::buildLights()
 {
-    float emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()) {
-            emit_area_sum += objects[k]->getArea();
+    emitters.clear();
+    emitterIndex.clear();
+    std::vector<float> areas;
+    for (Object* object : objects) {
+        if (object->hasEmit()) {
+            emitterIndex[object] = (int)emitters.size();
+            emitters.push_back(object);
+            areas.push_back(object->getArea());
         }
     }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()) {
-            emit_area_sum += objects[k]->getArea();
-            if (p <= emit_area_sum) {
-                objects[k]->Sample(pos, pdf);
-                break;
-            }
-        }
+    emitterTable = AliasTable(areas);
+}
+
+Intersection Scene::intersect(const Ray& ray) const
+{
+    Intersection hit = this->bvh->Intersect(ray);
+    STAT_ADD(kStatHits, hit.happened);
+    return hit;
+}
+
+// 光线在到达 tMax 之前是否被挡住, 用于阴影光线
+bool Scene::intersectP(const Ray& ray, float tMax) const
+{
+    Ray shadowRay = ray;
+    shadowRay.t_max = tMax;
+    bool occluded = this->bvh->IntersectP(shadowRay);
+    STAT_ADD(kStatOccluded, occluded);
+    return occluded;
+}
+
+// 一组相邻光线一起遍历 BVH, hits 的长度至少为 count
+void Scene::intersectPacket(const Ray* rays, int count, Intersection* hits) const
+{
+    for (int i = 0; i < count; ++i)
+        hits[i] = Intersection();
+    this->bvh->IntersectPacket(rays, count, (1u << count) - 1, hits);
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < count; ++i)
+        STAT_ADD(kStatHits, hits[i].happened);
+#endif
+}
+
+// 阴影光线包, 每条光线的最大距离由 rays[i].t_max 给出, 返回被挡住的光线的掩码
+uint32_t Scene::intersectPPacket(const Ray* rays, int count) const
+{
+    uint32_t occluded = this->bvh->IntersectPPacket(rays, count, (1u << count) - 1);
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < count; ++i)
+        STAT_ADD(kStatOccluded, (occluded >> i) & 1);
+#endif
+    return occluded;
+}
+
+
+void Scene::sampleLight(Intersection& pos, float& pdf, Sampler& sampler) const
+{
+    if (emitterTable.empty()) {
+        pdf = 0;
+        return;
     }
+    // 按面积选一个发光物体, 再在它上面均匀取点, 合起来对所有发光面积是均匀的
+    float pmf;
+    Object* light = emitters[emitterTable.Sample(sampler.Get1D(), &pmf)];
+    light->Sample(pos, pdf, sampler);
+    pos.obj = light;
+    pdf *= pmf;
+}
+
+float Scene::pdfLight(const Object* light) const
+{
+    auto it = emitterIndex.find(light);
+    if (it == emitterIndex.end())
+        return 0;
+    return emitterTable.PMF(it->second) / emitters[it->second]->getArea();
 }
 
 bool Scene::trace(
@@ -59,7 +121,7 @@ bool Scene::trace(
 }
 
 // Implementation of Path Tracing
-Vector3f Scene::castRay(const Ray& ray, int depth) const
+Vector3f Scene::castRay(const Ray& ray, int depth, Sampler& sampler, AOVSample* aov) const
 {
     // TO DO Implement Path Tracing Algorithm here
     // 递归最大深度
@@ -67,49 +129,172 @@ Vector3f Scene::castRay(const Ray& ray, int depth) const
         return Vector3f();
 
     // 寻找射线打中的物体
+    STAT_ADD(kStatPrimaryRays, 1);
     Intersection objInter = intersect(ray); //打中的物体
-    Material* material = objInter.m;
-    const Vector3f& objNormal = objInter.normal;
-    const Vector3f& rayDir = ray.direction;
     if (!objInter.happened)
         return Vector3f();
+    if (aov)
+        *aov = FirstHitAOV(objInter);
 
-    // 打到光源
+    // 直接看到光源. 反弹之后打中光源的情况在 indirectLight 里按 MIS 权重计入
     if (objInter.m->hasEmission()) {
         return objInter.m->getEmission();
     }
 
-    // 计算直接光照和间接光照
-    Vector3f dirLight, indirLight;
+    return shade(ray, objInter, depth, sampler);
+}
+
+// 非光源表面 objInter 的直接光照和间接光照
+Vector3f Scene::shade(const Ray& ray, const Intersection& objInter, int depth, Sampler& sampler) const
+{
+    STAT_PATH_VERTICES(depth, 1);
+    Vector3f dirLight;
     Intersection lightInter;    // 采样的光源点
     float lightPDF;
-    sampleLight(lightInter, lightPDF);
+    sampleLight(lightInter, lightPDF, sampler);
 
     Vector3f objToLightDir(lightInter.coords - objInter.coords);
     Ray lightRay(objInter.coords, objToLightDir.normalized());  // 出射向量
     // 直接光照,这里需要判断光源和着色点之间是否有阻挡，同时需要预留浮点数的误差
-    if (intersect(lightRay).distance - objToLightDir.norm() > -0.001) {
-        dirLight = lightInter.emit
-            * material->eval(rayDir, lightRay.direction, objNormal)
-            * dotProduct(lightRay.direction, objNormal)
-            * dotProduct(-lightRay.direction, lightInter.normal)
-            / pow(objToLightDir.norm(), 2)
-            / lightPDF;
+    STAT_ADD(kStatShadowRays, 1);
+    if (!intersectP(lightRay, objToLightDir.norm() - 0.001f)) {
+        dirLight = directLight(ray, objInter, lightInter, lightPDF);
     }
 
-    // 间接光照
-    if (get_random_float() < RussianRoulette) {
-        Vector3f sampleDir = material->sample(rayDir, objNormal).normalized();  // 采样的向量
-        Ray sampleRay(objInter.coords, sampleDir);
-        Intersection sampleInter = intersect(sampleRay);    // 采样向量打到的点
-        if (sampleInter.happened && !sampleInter.m->hasEmission()) {
-            indirLight = castRay(sampleRay, depth + 1)
-                * material->eval(rayDir, sampleDir, objNormal)
-                * dotProduct(sampleDir, objNormal)
-                / material->pdf(rayDir, sampleDir, objNormal)
-                / RussianRoulette;
+    return dirLight + indirectLight(ray, objInter, depth, sampler);
+}
+
+// 与 castRay 的第一次反弹相同, 只是相机光线和同一个光源的阴影光线都按光线包求交.
+// 每条光线用自己的 sampler, 取随机数的顺序与 castRay 一致, 所以结果完全相同.
+void Scene::castRayPacket(const Ray* rays, int count, Sampler* samplers, Vector3f* radiance,
+                          AOVSample* aovs) const
+{
+    Intersection hits[kMaxPacketSize];
+    STAT_ADD(kStatPrimaryRays, count);
+    intersectPacket(rays, count, hits);
+    if (aovs) {
+        for (int i = 0; i < count; ++i)
+            aovs[i] = hits[i].happened ? FirstHitAOV(hits[i]) : AOVSample();
+    }
+
+    Intersection lightInters[kMaxPacketSize];
+    float lightPDFs[kMaxPacketSize];
+    uint32_t shading = 0;   // 打中非光源表面, 需要计算光照的光线
+    for (int i = 0; i < count; ++i) {
+        radiance[i] = Vector3f();
+        if (!hits[i].happened)
+            continue;
+        if (hits[i].m->hasEmission()) {
+            radiance[i] = hits[i].m->getEmission();
+            continue;
         }
+        sampleLight(lightInters[i], lightPDFs[i], samplers[i]);
+        shading |= 1u << i;
+        STAT_PATH_VERTICES(0, 1);
     }
 
-    return dirLight + indirLight;
-}
\ No newline at end of file
+    // 采样到同一个光源的阴影光线方向大致相同, 放在一个包里求交
+    std::vector<Ray> shadowRays;
+    shadowRays.reserve(kMaxPacketSize);
+    int shadowIndex[kMaxPacketSize];
+    uint32_t remaining = shading;
+    while (remaining) {
+        int first = 0;
+        while (!(remaining & (1u << first)))
+            ++first;
+        const Object* light = lightInters[first].obj;
+
+        shadowRays.clear();
+        for (int i = first; i < count; ++i) {
+            if (!(remaining & (1u << i)) || lightInters[i].obj != light)
+                continue;
+            Vector3f objToLightDir(lightInters[i].coords - hits[i].coords);
+            shadowRays.emplace_back(hits[i].coords, objToLightDir.normalized());
+            shadowRays.back().t_max = objToLightDir.norm() - 0.001f;
+            shadowIndex[shadowRays.size() - 1] = i;
+            remaining &= ~(1u << i);
+        }
+
+        STAT_ADD(kStatShadowRays, shadowRays.size());
+        uint32_t occluded = intersectPPacket(shadowRays.data(), (int)shadowRays.size());
+        for (int k = 0; k < (int)shadowRays.size(); ++k) {
+            int i = shadowIndex[k];
+            if (!(occluded & (1u << k)))
+                radiance[i] = directLight(rays[i], hits[i], lightInters[i], lightPDFs[i]);
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (shading & (1u << i))
+            radiance[i] = radiance[i] + indirectLight(rays[i], hits[i], 0, samplers[i]);
+    }
+}
+
+// 着色点 objInter 从光源采样点 lightInter 得到的直接光照, 调用者负责判断可见性.
+// 同一方向也可能由 BSDF 采样得到, 所以乘上光源采样一侧的 MIS 权重
+Vector3f Scene::directLight(const Ray& ray, const Intersection& objInter, const Intersection& lightInter,
+                            float lightPDF) const
+{
+    if (lightPDF <= 0)
+        return Vector3f();
+    Vector3f objToLightDir(lightInter.coords - objInter.coords);
+    float dist2 = dotProduct(objToLightDir, objToLightDir);
+    Vector3f lightDir = objToLightDir.normalized();
+    // 光源是单面的, 背面不发光
+    float cosLight = dotProduct(-lightDir, lightInter.normal);
+    if (cosLight <= 0)
+        return Vector3f();
+
+    // 面积上的 pdf 换算成立体角上的 pdf
+    float lightPdfW = lightPDF * dist2 / cosLight;
+    float bsdfPdfW = objInter.m->pdf(ray.direction, lightDir, objInter.normal);
+    return lightInter.emit
+        * objInter.m->eval(ray.direction, lightDir, objInter.normal)
+        * dotProduct(lightDir, objInter.normal)
+        / lightPdfW
+        * PowerHeuristic(lightPdfW, bsdfPdfW);
+}
+
+// BSDF 采样的光线 ray 打中光源 lightInter 时带回的自发光, 乘上 BSDF 采样一侧的 MIS 权重.
+// bsdfPDF 是采样这个方向时的立体角 pdf
+Vector3f Scene::emittedLight(const Ray& ray, const Intersection& lightInter, float bsdfPDF) const
+{
+    float cosLight = dotProduct(-ray.direction, lightInter.normal);
+    if (cosLight <= 0)
+        return Vector3f();
+    float dist = (float)lightInter.distance;
+    float lightPdfW = pdfLight(lightInter.obj) * dist * dist / cosLight;
+    return lightInter.m->getEmission() * PowerHeuristic(bsdfPDF, lightPdfW);
+}
+
+// 间接光照: 按 BSDF 采样一个方向. 打中光源时按 MIS 权重计入它的自发光,
+// 打中其他表面时在那里继续 shade
+Vector3f Scene::indirectLight(const Ray& ray, const Intersection& objInter, int depth, Sampler& sampler) const
+{
+    Material* material = objInter.m;
+    const Vector3f& objNormal = objInter.normal;
+    const Vector3f& rayDir = ray.direction;
+    if (sampler.Get1D() >= RussianRoulette)
+        return Vector3f();
+
+    Vector3f sampleDir = material->sample(rayDir, objNormal, sampler).normalized();  // 采样的向量
+    float pdf = material->pdf(rayDir, sampleDir, objNormal);
+    if (pdf <= 0)
+        return Vector3f();
+    Ray sampleRay(objInter.coords, sampleDir);
+    STAT_ADD(kStatIndirectRays, 1);
+    Intersection sampleInter = intersect(sampleRay);    // 采样向量打到的点
+    if (!sampleInter.happened)
+        return Vector3f();
+
+    Vector3f beta = material->eval(rayDir, sampleDir, objNormal)
+        * dotProduct(sampleDir, objNormal)
+        / pdf
+        / RussianRoulette;
+    // 超过最大深度的表面不再着色, 但打中光源的这一段路径长度与同一点的光源采样相同, 仍然要算
+    if (sampleInter.m->hasEmission())
+        return beta * emittedLight(sampleRay, sampleInter, pdf);
+    if (depth + 1 > maxDepth)
+        return Vector3f();
+    return beta * shade(sampleRay, sampleInter, depth + 1, sampler);
+}
@@ -5,12 +5,15 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
 #include "Vector.hpp"
 #include "Object.hpp"
 #include "Light.hpp"
 #include "AreaLight.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
+#include "AliasTable.hpp"
+#include "Film.hpp"
 
 
 class Scene
@@ -33,10 +36,29 @@ public:
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
-    void buildBVH();
-    Vector3f castRay(const Ray &ray, int depth) const;
-    void sampleLight(Intersection &pos, float &pdf) const;
+    bool intersectP(const Ray& ray, float tMax) const;
+    void intersectPacket(const Ray* rays, int count, Intersection* hits) const;
+    uint32_t intersectPPacket(const Ray* rays, int count) const;
+    std::unique_ptr<BVHAccel> bvh;
+    // 场景的顶层 BVH. 网格各自的 BVH 在创建时已经建好
+    void buildBVH(int maxPrimsInNode = 4,
+                  BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH,
+                  BVHAccel::TreeWidth treeWidth = BVHAccel::TreeWidth::BINARY);
+    // 移动 Instance (SetTransform) 或网格变形 (MeshTriangle::UpdateVertices) 之后调用:
+    // 顶层 BVH 只 refit, SAH 代价涨得太多时才局部重建, 比 buildBVH 便宜得多
+    void updateBVH();
+    // aov 不为空时填入相机光线第一个交点的 AOV (只在 depth == 0 时有意义)
+    Vector3f castRay(const Ray &ray, int depth, Sampler &sampler, AOVSample *aov = nullptr) const;
+    void castRayPacket(const Ray* rays, int count, Sampler* samplers, Vector3f* radiance,
+                       AOVSample* aovs = nullptr) const;
+    Vector3f shade(const Ray &ray, const Intersection &objInter, int depth, Sampler &sampler) const;
+    Vector3f directLight(const Ray &ray, const Intersection &objInter, const Intersection &lightInter,
+                         float lightPDF) const;
+    Vector3f emittedLight(const Ray &ray, const Intersection &lightInter, float bsdfPDF) const;
+    Vector3f indirectLight(const Ray &ray, const Intersection &objInter, int depth, Sampler &sampler) const;
+    void sampleLight(Intersection &pos, float &pdf, Sampler &sampler) const;
+    // sampleLight 在发光物体 light 上取到某一点的概率密度 (面积测度), 给 MIS 用
+    float pdfLight(const Object* light) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -47,6 +69,12 @@ public:
     std::vector<Object* > objects;
     std::vector<std::unique_ptr<Light> > lights;
 
+    // 发光物体和按面积建的别名表, 在 buildBVH 里建好
+    std::vector<Object*> emitters;
+    std::unordered_map<const Object*, int> emitterIndex;
+    AliasTable emitterTable;
+    void buildLights();
+
     // Compute reflection direction
     Vector3f reflect(const Vector3f &I, const Vector3f &N) const
     {
@@ -109,4 +137,14 @@ public:
         // As a consequence of the conservation of energy, transmittance is given by:
         // kt = 1 - kr;
     }
-};
\ No newline at end of file
+};
+
+// 交点的反照率, 法线和距离
+inline AOVSample FirstHitAOV(const Intersection& hit)
+{
+    AOVSample aov;
+    aov.albedo = hit.m->getAlbedo();
+    aov.normal = hit.normal;
+    aov.depth = (float)hit.distance;
+    return aov;
+}
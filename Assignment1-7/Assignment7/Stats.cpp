@@ -0,0 +1,127 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+//
+// Ray and traversal statistics: per-thread counters merged into a JSON report.
+//
+
+#include "Stats.hpp"
+
+#ifdef RAYTRACING_STATS
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// ParallelFor 每次都新建线程, 退出的线程把计数并到 retired 里
+struct StatsRegistry
+{
+    std::mutex mutex;
+    std::vector<RayStats*> live;
+    RayStats retired;
+};
+
+StatsRegistry& Registry()
+{
+    static StatsRegistry registry;
+    return registry;
+}
+
+struct ThreadStatsOwner
+{
+    RayStats stats;
+
+    ThreadStatsOwner()
+    {
+        StatsRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.live.push_back(&stats);
+    }
+    ~ThreadStatsOwner()
+    {
+        StatsRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.retired.Merge(stats);
+        registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &stats));
+        threadStats = nullptr;
+    }
+};
+
+double PerSecond(uint64_t count, double seconds)
+{
+    return seconds > 0 ? count / seconds : 0.0;
+}
+
+} // namespace
+
+RayStats& RegisterThreadStats()
+{
+    thread_local ThreadStatsOwner owner;
+    threadStats = &owner.stats;
+    return owner.stats;
+}
+
+void ResetStats()
+{
+    StatsRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retired = RayStats();
+    for (RayStats* stats : registry.live)
+        *stats = RayStats();
+}
+
+bool WriteStatsReport(const std::string& filename, double seconds)
+{
+    // 调用时渲染线程都已经结束, 还活着的只有调用线程自己
+    RayStats total;
+    {
+        StatsRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        total = registry.retired;
+        for (const RayStats* stats : registry.live)
+            total.Merge(*stats);
+    }
+    const uint64_t* c = total.counters;
+    uint64_t rays = c[kStatPrimaryRays] + c[kStatShadowRays] + c[kStatIndirectRays];
+
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (!fp)
+        return false;
+    fprintf(fp, "{\n  \"seconds\": %.6f,\n  \"rays\": {\n", seconds);
+    const char* names[] = { "primary", "shadow", "indirect" };
+    for (int i = 0; i < 3; ++i) {
+        fprintf(fp, "    \"%s\": { \"count\": %llu, \"mrays_per_second\": %.4f },\n", names[i],
+                (unsigned long long)c[i], PerSecond(c[i], seconds) * 1e-6);
+    }
+    fprintf(fp, "    \"total\": { \"count\": %llu, \"mrays_per_second\": %.4f }\n  },\n",
+            (unsigned long long)rays, PerSecond(rays, seconds) * 1e-6);
+
+    fprintf(fp, "  \"traversal\": {\n");
+    fprintf(fp, "    \"nodes_visited\": %llu,\n", (unsigned long long)c[kStatNodesVisited]);
+    fprintf(fp, "    \"box_tests\": %llu,\n", (unsigned long long)c[kStatBoxTests]);
+    fprintf(fp, "    \"triangle_tests\": %llu,\n", (unsigned long long)c[kStatTriangleTests]);
+    fprintf(fp, "    \"hits\": %llu,\n", (unsigned long long)c[kStatHits]);
+    fprintf(fp, "    \"occluded\": %llu,\n", (unsigned long long)c[kStatOccluded]);
+    fprintf(fp, "    \"nodes_per_ray\": %.3f,\n", rays ? c[kStatNodesVisited] / (double)rays : 0.0);
+    fprintf(fp, "    \"triangles_per_ray\": %.3f\n  },\n", rays ? c[kStatTriangleTests] / (double)rays : 0.0);
+
+    // 长度为 L 的路径在深度 L - 1 着色后没有继续; 长度 0 是没打中或直接看到光源.
+    // 最后一项是长度不小于 kStatMaxDepth 的路径
+    uint64_t paths = c[kStatPrimaryRays], vertices = 0;
+    fprintf(fp, "  \"paths\": {\n    \"count\": %llu,\n", (unsigned long long)paths);
+    for (int d = 0; d < kStatMaxDepth; ++d)
+        vertices += total.pathVertices[d];
+    fprintf(fp, "    \"average_length\": %.4f,\n", paths ? vertices / (double)paths : 0.0);
+    fprintf(fp, "    \"length_histogram\": [");
+    for (int length = 0; length <= kStatMaxDepth; ++length) {
+        uint64_t reached = length == 0 ? paths : total.pathVertices[length - 1];
+        uint64_t continued = length < kStatMaxDepth ? total.pathVertices[length] : 0;
+        fprintf(fp, "%s%llu", length ? ", " : "", (unsigned long long)(reached - continued));
+    }
+    fprintf(fp, "]\n  }\n}\n");
+    return fclose(fp) == 0;
+}
+
+#endif
@@ -0,0 +1,71 @@
+//
+// Ray and traversal statistics: per-thread counters merged into a JSON report.
+// Only compiled in when RAYTRACING_STATS is defined (cmake -DRAYTRACING_STATS=ON).
+//
+
+#ifndef RAYTRACING_STATS_H
+#define RAYTRACING_STATS_H
+
+#include <cstdint>
+#include <string>
+
+enum StatCounter {
+    kStatPrimaryRays,       // 相机光线
+    kStatShadowRays,        // 光源采样的阴影光线
+    kStatIndirectRays,      // BSDF 采样的反弹光线
+    kStatNodesVisited,      // 遍历时取出的 BVH 节点, 场景和网格的 BVH 都算
+    kStatBoxTests,          // 光线与包围盒的测试, 宽 BVH 的一个节点算 N 次
+    kStatTriangleTests,     // 光线与三角形的测试
+    kStatHits,              // 找到交点的最近交点查询
+    kStatOccluded,          // 被挡住的阴影光线
+    kStatCount
+};
+
+// 路径顶点按深度统计, 更深的不再记录
+constexpr int kStatMaxDepth = 16;
+
+struct RayStats
+{
+    uint64_t counters[kStatCount] = {};
+    // pathVertices[d]: 在深度 d 着色的表面点个数, 也就是走到第 d + 1 个顶点的路径数
+    uint64_t pathVertices[kStatMaxDepth] = {};
+
+    void Merge(const RayStats& other)
+    {
+        for (int i = 0; i < kStatCount; ++i)
+            counters[i] += other.counters[i];
+        for (int d = 0; d < kStatMaxDepth; ++d)
+            pathVertices[d] += other.pathVertices[d];
+    }
+};
+
+#ifdef RAYTRACING_STATS
+
+// 每个线程第一次计数时注册自己的 RayStats, 线程退出时并入全局的总数
+RayStats& RegisterThreadStats();
+inline thread_local RayStats* threadStats = nullptr;
+
+inline RayStats& ThreadStats()
+{
+    RayStats* stats = threadStats;
+    return stats ? *stats : RegisterThreadStats();
+}
+
+// 清零所有线程的计数
+void ResetStats();
+
+// 合并所有线程的计数写成 JSON, seconds 是渲染用时, 用来算每种光线的 Mrays/s
+bool WriteStatsReport(const std::string& filename, double seconds);
+
+#define STAT_ADD(counter, n) (ThreadStats().counters[counter] += (uint64_t)(n))
+#define STAT_PATH_VERTICES(depth, n) \
+    ((depth) < kStatMaxDepth ? (void)(ThreadStats().pathVertices[depth] += (uint64_t)(n)) : (void)0)
+
+#else
+
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_PATH_VERTICES(depth, n) ((void)0)
+
+#endif
+
+#endif //RAYTRACING_STATS_H
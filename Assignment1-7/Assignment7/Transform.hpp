@@ -0,0 +1,144 @@
+//
+// Affine transforms for placing instances in the scene.
+//
+
+#ifndef RAYTRACING_TRANSFORM_H
+#define RAYTRACING_TRANSFORM_H
+
+#include <cmath>
+#include "Vector.hpp"
+#include "Bounds3.hpp"
+#include "global.hpp"
+
+// 3x4 仿射矩阵 (最后一行总是 0 0 0 1), 同时保存逆矩阵.
+// 点和向量用 m 变换, 法线用逆矩阵的转置变换.
+class Transform
+{
+public:
+    Transform() : Transform(Identity(), Identity()) {}
+
+    static Transform Translate(const Vector3f& t)
+    {
+        Matrix m = Identity(), inv = Identity();
+        for (int i = 0; i < 3; ++i) {
+            m.v[i][3] = t[i];
+            inv.v[i][3] = -t[i];
+        }
+        return Transform(m, inv);
+    }
+
+    static Transform Scale(const Vector3f& s)
+    {
+        Matrix m = Identity(), inv = Identity();
+        for (int i = 0; i < 3; ++i) {
+            m.v[i][i] = s[i];
+            inv.v[i][i] = 1 / s[i];
+        }
+        return Transform(m, inv);
+    }
+
+    static Transform Scale(float s) { return Scale(Vector3f(s)); }
+
+    // 绕 axis 旋转 degrees 度 (右手), 旋转矩阵的逆就是转置
+    static Transform Rotate(float degrees, const Vector3f& axis)
+    {
+        Vector3f a = normalize(axis);
+        float theta = deg2rad(degrees);
+        float s = std::sin(theta), c = std::cos(theta);
+        Matrix m = Identity();
+        m.v[0][0] = a.x * a.x + (1 - a.x * a.x) * c;
+        m.v[0][1] = a.x * a.y * (1 - c) - a.z * s;
+        m.v[0][2] = a.x * a.z * (1 - c) + a.y * s;
+        m.v[1][0] = a.x * a.y * (1 - c) + a.z * s;
+        m.v[1][1] = a.y * a.y + (1 - a.y * a.y) * c;
+        m.v[1][2] = a.y * a.z * (1 - c) - a.x * s;
+        m.v[2][0] = a.x * a.z * (1 - c) - a.y * s;
+        m.v[2][1] = a.y * a.z * (1 - c) + a.x * s;
+        m.v[2][2] = a.z * a.z + (1 - a.z * a.z) * c;
+        Matrix inv = Identity();
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                inv.v[i][j] = m.v[j][i];
+        return Transform(m, inv);
+    }
+
+    // 先做 t 再做 *this
+    Transform operator*(const Transform& t) const
+    {
+        return Transform(Multiply(m, t.m), Multiply(t.inv, inv));
+    }
+
+    Transform Inverse() const { return Transform(inv, m); }
+
+    Vector3f Point(const Vector3f& p) const { return Apply(m, p, 1); }
+    Vector3f Vector(const Vector3f& v) const { return Apply(m, v, 0); }
+    // 结果没有归一化
+    Vector3f Normal(const Vector3f& n) const
+    {
+        return Vector3f(inv.v[0][0] * n.x + inv.v[1][0] * n.y + inv.v[2][0] * n.z,
+                        inv.v[0][1] * n.x + inv.v[1][1] * n.y + inv.v[2][1] * n.z,
+                        inv.v[0][2] * n.x + inv.v[1][2] * n.y + inv.v[2][2] * n.z);
+    }
+
+    // 变换 8 个角点后重新求包围盒
+    Bounds3 operator()(const Bounds3& b) const
+    {
+        Bounds3 result;
+        for (int corner = 0; corner < 8; ++corner) {
+            Vector3f p((corner & 1) ? b.pMax.x : b.pMin.x,
+                       (corner & 2) ? b.pMax.y : b.pMin.y,
+                       (corner & 4) ? b.pMax.z : b.pMin.z);
+            result = Union(result, Point(p));
+        }
+        return result;
+    }
+
+    // 左上 3x3 的行列式, 面积的缩放等都由它决定
+    float Determinant() const
+    {
+        const float (*a)[4] = m.v;
+        return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+             - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+             + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    }
+
+private:
+    struct Matrix
+    {
+        float v[3][4];
+    };
+
+    Transform(const Matrix& m, const Matrix& inv) : m(m), inv(inv) {}
+
+    static Matrix Identity()
+    {
+        Matrix r = {};
+        for (int i = 0; i < 3; ++i)
+            r.v[i][i] = 1;
+        return r;
+    }
+
+    static Matrix Multiply(const Matrix& a, const Matrix& b)
+    {
+        Matrix r;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                r.v[i][j] = a.v[i][0] * b.v[0][j] + a.v[i][1] * b.v[1][j] + a.v[i][2] * b.v[2][j];
+                if (j == 3)
+                    r.v[i][j] += a.v[i][3];
+            }
+        }
+        return r;
+    }
+
+    static Vector3f Apply(const Matrix& a, const Vector3f& p, float w)
+    {
+        return Vector3f(a.v[0][0] * p.x + a.v[0][1] * p.y + a.v[0][2] * p.z + a.v[0][3] * w,
+                        a.v[1][0] * p.x + a.v[1][1] * p.y + a.v[1][2] * p.z + a.v[1][3] * w,
+                        a.v[2][0] * p.x + a.v[2][1] * p.y + a.v[2][2] * p.z + a.v[2][3] * w);
+    }
+
+    Matrix m, inv;
+};
+
+#endif //RAYTRACING_TRANSFORM_H
@@ -3,11 +3,15 @@
 #include "BVH.hpp"
 #include "Intersection.hpp"
 #include "Material.hpp"
-#include "OBJ_Loader.hpp"
 #include "Object.hpp"
 #include "Triangle.hpp"
+#include "TriangleBlock.hpp"
+#include "AliasTable.hpp"
+#include "MeshCache.hpp"
+#include "ObjParser.hpp"
 #include <cassert>
 #include <array>
+#include <mutex>
 
 bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
                           const Vector3f& v2, const Vector3f& orig,
@@ -72,8 +76,9 @@ public:
     }
     Vector3f evalDiffuseColor(const Vector2f&) const override;
     Bounds3 getBounds() override;
-    void Sample(Intersection &pos, float &pdf){
-        float x = std::sqrt(get_random_float()), y = get_random_float();
+    void Sample(Intersection &pos, float &pdf, Sampler &sampler){
+        Vector2f u = sampler.Get2D();
+        float x = std::sqrt(u.x), y = u.y;
         pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
         pos.normal = this->normal;
         pdf = 1.0f / area;
@@ -86,93 +91,362 @@ public:
     }
 };
 
-class MeshTriangle : public Object
+// 索引网格: 所有三角形共用一个顶点数组, 每个三角形只存三个 32 位顶点下标.
+// 法线, 面积等逐面数据在用到时由顶点算出. 求交时 BVH 叶子里的三角形
+// 打包成 4/8 个一组的 SoA 块, 用 SIMD 一次测完整个块.
+class MeshTriangle : public Object, public BVHLeafIntersector
 {
 public:
-    MeshTriangle(const std::string& filename, Material *mt = new Material())
+    // useCache 时先找源文件旁边的缓存, 哈希和建树参数都对得上就直接映射缓存里的
+    // 顶点, 索引和 BVH, 否则照常解析 OBJ 并建树, 然后写出缓存给下次用.
+    // OBJ 读不了时报错, loaded() 为 false
+    MeshTriangle(const std::string& filename, Material *mt = new Material(),
+                 int maxPrimsInNode = 4,
+                 BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH,
+                 BVHAccel::TreeWidth treeWidth = BVHAccel::TreeWidth::BINARY,
+                 bool useCache = false)
     {
-        objl::Loader loader;
-        loader.LoadFile(filename);
         area = 0;
         m = mt;
-        assert(loader.LoadedMeshes.size() == 1);
-        auto mesh = loader.LoadedMeshes[0];
+        // 叶子放得下 8 个三角形并且 CPU 支持 AVX2 时用 8 宽的块
+        blockWidth = maxPrimsInNode >= 8 && CpuSupportsAVX2() ? 8 : 4;
+
+        MeshCacheKey key;
+        key.maxPrimsInNode = maxPrimsInNode;
+        key.splitMethod = (int32_t)splitMethod;
+        key.treeWidth = (int32_t)BVHAccel::SupportedWidth(treeWidth);
+        key.blockWidth = blockWidth;
+        useCache = useCache && HashFile(filename, key.sourceHash);
+        std::string cacheFile = MeshCachePath(filename, key);
+        std::vector<int32_t> faceOrder;
+        if (useCache && loadCache(cacheFile, key, maxPrimsInNode, splitMethod, faceOrder)) {
+            printf("Loaded mesh cache %s: %d triangles, %d BVH nodes\n\n", cacheFile.c_str(),
+                   (int)TriangleCount(), bvh->totalNodes);
+        }
+        else {
+            if (!loadObj(filename))
+                return;
+            buildBVH(maxPrimsInNode, splitMethod, treeWidth, faceOrder);
+            if (blockWidth == 8)
+                buildTriangleBlocks(blocks8);
+            else
+                buildTriangleBlocks(blocks4);
+            if (useCache && !saveCache(cacheFile, key, faceOrder))
+                std::cerr << "Warning: could not write mesh cache " << cacheFile << "\n";
+        }
+        bvh->leafIntersector = this;
+
+        // 发光的网格按三角形面积建别名表, 采样光源时 O(1) 选三角形.
+        // 表按 OBJ 中的顺序建, 与三角形的存放顺序无关
+        if (hasEmit())
+            std::call_once(tableOnce, [&] { buildTriangleTable(faceOrder); });
+    }
+
+    // 顶点动画: 换成个数相同的一组新顶点, 三角形的连接关系不变. 网格的 BVH 先 refit,
+    // SAH 代价涨得太多时局部重建, 再重新打包三角形块. 之后还要调用 Scene::updateBVH 更新顶层
+    bool UpdateVertices(std::vector<Vector3f> newPositions)
+    {
+        if (newPositions.size() != positions.size())
+            return false;
+        positions.assign(std::move(newPositions));
+        if (bvh->Update(triangleBounds())) {
+            // 重建的子树调换了三角形的顺序, 索引和别名表的映射跟着换
+            // 从缓存读出的网格 indices 还指向映射的文件, 只能通过 const 的接口读
+            const std::vector<int>& order = bvh->primitiveOrder;
+            const MappedArray<uint32_t>& oldIndices = indices;
+            std::vector<uint32_t> ordered(indices.size());
+            std::vector<int> newIndex(order.size());
+            for (size_t tri = 0; tri < order.size(); ++tri) {
+                for (int k = 0; k < 3; ++k)
+                    ordered[3 * tri + k] = oldIndices[3 * order[tri] + k];
+                newIndex[order[tri]] = (int)tri;
+            }
+            indices.assign(std::move(ordered));
+            if (!triangleTable.empty()) {
+                if (tableTriangle.empty())
+                    tableTriangle = newIndex;
+                else {
+                    for (int& tri : tableTriangle)
+                        tri = newIndex[tri];
+                }
+            }
+            std::vector<int>().swap(bvh->primitiveOrder);
+        }
+        if (blockWidth == 8)
+            buildTriangleBlocks(blocks8);
+        else
+            buildTriangleBlocks(blocks4);
+        computeBoundsAndArea();
+        if (!triangleTable.empty())
+            updateTriangleTable();
+        return true;
+    }
+
+    // 构造时 OBJ 读取失败 (文件不存在, 格式错误或者没有面) 就没有 BVH, 不能加进场景
+    bool loaded() const { return bvh != nullptr; }
+
+    // 三角形先按 OBJ 中的顺序存, 建树之后再按叶子的顺序重排
+    bool loadObj(const std::string& filename)
+    {
+        ObjMesh mesh;
+        std::string error;
+        if (!ParseObj(filename, mesh, error)) {
+            std::cerr << "Error: " << error << "\n";
+            return false;
+        }
+        if (mesh.positionIndex.empty()) {
+            std::cerr << "Error: " << filename << ": no faces\n";
+            return false;
+        }
 
+        std::vector<uint32_t> faces(mesh.positionIndex.begin(), mesh.positionIndex.end());
+        positions.assign(std::move(mesh.positions));
+        indices.assign(std::move(faces));
+        computeBoundsAndArea();
+        return true;
+    }
+
+    void computeBoundsAndArea()
+    {
         Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
                                      std::numeric_limits<float>::infinity(),
                                      std::numeric_limits<float>::infinity()};
         Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
                                      -std::numeric_limits<float>::infinity(),
                                      -std::numeric_limits<float>::infinity()};
-        for (int i = 0; i < mesh.Vertices.size(); i += 3) {
-            std::array<Vector3f, 3> face_vertices;
-
-            for (int j = 0; j < 3; j++) {
-                auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-                                     mesh.Vertices[i + j].Position.Y,
-                                     mesh.Vertices[i + j].Position.Z);
-                face_vertices[j] = vert;
-
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
+        for (uint32_t index : indices) {
+            const Vector3f& vert = positions[index];
+            min_vert = Vector3f(std::min(min_vert.x, vert.x),
+                                std::min(min_vert.y, vert.y),
+                                std::min(min_vert.z, vert.z));
+            max_vert = Vector3f(std::max(max_vert.x, vert.x),
+                                std::max(max_vert.y, vert.y),
+                                std::max(max_vert.z, vert.z));
+        }
+        bounding_box = Bounds3(min_vert, max_vert);
+        area = 0;
+        for (size_t tri = 0; tri < TriangleCount(); ++tri)
+            area += faceArea((int)tri);
+    }
+
+    // 按存放的顺序给出每个三角形的包围盒
+    std::vector<Bounds3> triangleBounds() const
+    {
+        std::vector<Bounds3> bounds(TriangleCount());
+        for (size_t tri = 0; tri < bounds.size(); ++tri)
+            bounds[tri] = Union(Bounds3(vertex((int)tri, 0), vertex((int)tri, 1)), vertex((int)tri, 2));
+        return bounds;
+    }
+
+    // 按三角形的包围盒建树, 然后把索引重排成叶子的顺序, 叶子里的三角形就是连续的一段.
+    // faceOrder[i] 是重排后第 i 个三角形在 OBJ 中的位置
+    void buildBVH(int maxPrimsInNode, BVHAccel::SplitMethod splitMethod, BVHAccel::TreeWidth treeWidth,
+                  std::vector<int32_t>& faceOrder)
+    {
+        bvh.reset(new BVHAccel(triangleBounds(), maxPrimsInNode, splitMethod, treeWidth));
+        faceOrder.assign(bvh->primitiveOrder.begin(), bvh->primitiveOrder.end());
+        std::vector<int>().swap(bvh->primitiveOrder);
+
+        std::vector<uint32_t> ordered(indices.size());
+        for (size_t tri = 0; tri < faceOrder.size(); ++tri) {
+            for (int k = 0; k < 3; ++k)
+                ordered[3 * tri + k] = indices[3 * faceOrder[tri] + k];
+        }
+        indices.assign(std::move(ordered));
+    }
+
+    // 顶点和索引原样写出, 再加上叶子顺序到 OBJ 顺序的映射, 这样读回来的网格
+    // 光源别名表与直接建树时相同
+    bool saveCache(const std::string& cacheFile, const MeshCacheKey& key,
+                   const std::vector<int32_t>& faceOrder) const
+    {
+        MeshCacheData data;
+        data.bounds = bounding_box;
+        data.area = area;
+        data.positions = { positions.data(), (uint32_t)positions.size() };
+        data.indices = { indices.data(), (uint32_t)indices.size() };
+        data.faceOrder = { faceOrder.data(), (uint32_t)faceOrder.size() };
+        data.nodes = { bvh->nodes.data(), (uint32_t)bvh->nodes.size() };
+        data.wideNodes4 = { bvh->wideNodes4.data(), (uint32_t)bvh->wideNodes4.size() };
+        data.wideNodes8 = { bvh->wideNodes8.data(), (uint32_t)bvh->wideNodes8.size() };
+        data.blocks4 = { blocks4.data(), (uint32_t)blocks4.size() };
+        data.blocks8 = { blocks8.data(), (uint32_t)blocks8.size() };
+        return WriteMeshCache(cacheFile, key, data);
+    }
+
+    // 顶点, 索引, BVH 节点和三角形块都直接指向映射的文件, 不拷贝.
+    // faceOrder 只有发光的网格建别名表时才需要, 其他网格不读
+    bool loadCache(const std::string& cacheFile, const MeshCacheKey& key, int maxPrimsInNode,
+                   BVHAccel::SplitMethod splitMethod, std::vector<int32_t>& faceOrder)
+    {
+        std::unique_ptr<MappedFile> file(new MappedFile());
+        MeshCacheData data;
+        if (!ReadMeshCache(cacheFile, key, *file, data))
+            return false;
+        uint32_t nTriangles = data.faceOrder.count;
+        for (uint32_t i = 0; i < 3 * nTriangles; ++i) {
+            if (data.indices.data[i] >= data.positions.count)
+                return false;
+        }
+        if (hasEmit()) {
+            for (uint32_t i = 0; i < nTriangles; ++i) {
+                if (data.faceOrder.data[i] < 0 || data.faceOrder.data[i] >= (int32_t)nTriangles)
+                    return false;
             }
+            faceOrder.assign(data.faceOrder.data, data.faceOrder.data + nTriangles);
+        }
 
-            triangles.emplace_back(face_vertices[0], face_vertices[1],
-                                   face_vertices[2], mt);
+        positions = MappedArray<Vector3f>::View(data.positions.data, data.positions.count);
+        indices = MappedArray<uint32_t>::View(data.indices.data, data.indices.count);
+        bvh.reset(new BVHAccel(std::vector<Object*>(),
+                           MappedArray<LinearBVHNode>::View(data.nodes.data, data.nodes.count),
+                           MappedArray<WideBVHNode<4>>::View(data.wideNodes4.data, data.wideNodes4.count),
+                           MappedArray<WideBVHNode<8>>::View(data.wideNodes8.data, data.wideNodes8.count),
+                           maxPrimsInNode, splitMethod, (BVHAccel::TreeWidth)key.treeWidth));
+        blocks4 = MappedArray<TriangleBlock<4>>::View(data.blocks4.data, data.blocks4.count);
+        blocks8 = MappedArray<TriangleBlock<8>>::View(data.blocks8.data, data.blocks8.count);
+        bounding_box = data.bounds;
+        area = data.area;
+        mappedCache = std::move(file);
+        return true;
+    }
+
+    // 三角形已经是 BVH 叶子的顺序, 按顺序连续装进块里, 不按叶子对齐.
+    // 叶子的区间由下标直接算出所在的块和 lane, 不需要额外的表
+    template <int W>
+    void buildTriangleBlocks(MappedArray<TriangleBlock<W>>& blocks)
+    {
+        int nTriangles = (int)TriangleCount();
+        std::vector<TriangleBlock<W>> packed((nTriangles + W - 1) / W);
+        for (int index = 0; index < (int)packed.size() * W; ++index) {
+            TriangleBlock<W>& block = packed[index / W];
+            int lane = index % W;
+            Vector3f v0, e1, e2;
+            if (index < nTriangles) {
+                v0 = vertex(index, 0);
+                e1 = vertex(index, 1) - v0;
+                e2 = vertex(index, 2) - v0;
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                block.v0[axis][lane] = v0[axis];
+                block.e1[axis][lane] = e1[axis];
+                block.e2[axis][lane] = e2[axis];
+            }
         }
+        blocks.assign(std::move(packed));
+    }
 
-        bounding_box = Bounds3(min_vert, max_vert);
+    // 第 b 块中属于三角形区间 [first, end) 的 lane
+    template <int W>
+    static int BlockLaneMask(int first, int end, int b)
+    {
+        int lo = std::max(first - b * W, 0), hi = std::min(end - b * W, W);
+        return ((1 << hi) - 1) & ~((1 << lo) - 1);
+    }
 
-        std::vector<Object*> ptrs;
-        for (auto& tri : triangles){
-            ptrs.push_back(&tri);
-            area += tri.area;
+    // 别名表的第 k 项是 OBJ 中的第 k 个面, tableTriangle 把它换成存放的位置.
+    // 没有 faceOrder 时 (比如被换成发光材质的实例第一次采样) 按存放的顺序建
+    void buildTriangleTable(const std::vector<int32_t>& faceOrder)
+    {
+        if (!faceOrder.empty()) {
+            tableTriangle.resize(faceOrder.size());
+            for (size_t tri = 0; tri < faceOrder.size(); ++tri)
+                tableTriangle[faceOrder[tri]] = (int)tri;
         }
-        bvh = new BVHAccel(ptrs);
+        updateTriangleTable();
     }
 
-    bool intersect(const Ray& ray) { return true; }
+    void updateTriangleTable()
+    {
+        std::vector<float> areas(TriangleCount());
+        for (size_t k = 0; k < areas.size(); ++k)
+            areas[k] = faceArea(tableTriangle.empty() ? (int)k : tableTriangle[k]);
+        triangleTable = AliasTable(areas);
+    }
+
+    size_t TriangleCount() const { return indices.size() / 3; }
+
+    const Vector3f& vertex(int tri, int k) const { return positions[indices[3 * tri + k]]; }
+
+    // 与 Triangle 的构造函数相同的算法, 结果逐位相同
+    Vector3f faceNormal(int tri) const
+    {
+        const Vector3f& v0 = vertex(tri, 0);
+        return normalize(crossProduct(vertex(tri, 1) - v0, vertex(tri, 2) - v0));
+    }
+    float faceArea(int tri) const
+    {
+        const Vector3f& v0 = vertex(tri, 0);
+        return crossProduct(vertex(tri, 1) - v0, vertex(tri, 2) - v0).norm() * 0.5f;
+    }
 
-    bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
+    bool IntersectLeaf(const Ray& ray, int first, int count, float& tMax,
+                       HitRecord& hit) const override
     {
-        bool intersect = false;
-        for (uint32_t k = 0; k < numTriangles; ++k) {
-            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
-            const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
-            const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
-            float t, u, v;
-            if (rayTriangleIntersect(v0, v1, v2, ray.origin, ray.direction, t,
-                                     u, v) &&
-                t < tnear) {
-                tnear = t;
-                index = k;
-                intersect |= true;
+        bool found = false;
+        int end = first + count;
+        STAT_ADD(kStatTriangleTests, count);
+        if (blockWidth == 8) {
+            for (int b = first / 8; b * 8 < end; ++b) {
+                if (IntersectTriangleBlock8(blocks8[b], BlockLaneMask<8>(first, end, b), ray, tMax, hit)) {
+                    hit.index += b * 8;
+                    found = true;
+                }
+            }
+        }
+        else {
+            for (int b = first / 4; b * 4 < end; ++b) {
+                if (IntersectTriangleBlock4(blocks4[b], BlockLaneMask<4>(first, end, b), ray, tMax, hit)) {
+                    hit.index += b * 4;
+                    found = true;
+                }
             }
         }
+        return found;
+    }
 
-        return intersect;
+    void ComputeIntersection(const Ray& ray, const HitRecord& hit, Intersection& isect) const override
+    {
+        isect.happened = true;
+        isect.distance = hit.t;
+        isect.coords = ray(hit.t);
+        isect.normal = faceNormal(hit.index);
+        isect.m = m;
+        // 交点所属的场景物体是整个网格, 光源的 pdf 等都按网格查
+        isect.obj = const_cast<MeshTriangle*>(this);
     }
 
+    bool IntersectLeafP(const Ray& ray, int first, int count, float tMax) const override
+    {
+        int end = first + count;
+        if (blockWidth == 8) {
+            for (int b = first / 8; b * 8 < end; ++b) {
+                STAT_ADD(kStatTriangleTests, std::min(end, b * 8 + 8) - std::max(first, b * 8));
+                if (IntersectTriangleBlockP8(blocks8[b], BlockLaneMask<8>(first, end, b), ray, tMax))
+                    return true;
+            }
+        }
+        else {
+            for (int b = first / 4; b * 4 < end; ++b) {
+                STAT_ADD(kStatTriangleTests, std::min(end, b * 4 + 4) - std::max(first, b * 4));
+                if (IntersectTriangleBlockP4(blocks4[b], BlockLaneMask<4>(first, end, b), ray, tMax))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    bool intersect(const Ray& ray) { return bvh && bvh->IntersectP(ray); }
+
+    bool intersect(const Ray& ray, float& tnear, uint32_t& index) const { return false; }
+
     Bounds3 getBounds() { return bounding_box; }
 
     void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
                               const uint32_t& index, const Vector2f& uv,
                               Vector3f& N, Vector2f& st) const
     {
-        const Vector3f& v0 = vertices[vertexIndex[index * 3]];
-        const Vector3f& v1 = vertices[vertexIndex[index * 3 + 1]];
-        const Vector3f& v2 = vertices[vertexIndex[index * 3 + 2]];
-        Vector3f e0 = normalize(v1 - v0);
-        Vector3f e1 = normalize(v2 - v1);
-        N = normalize(crossProduct(e0, e1));
-        const Vector2f& st0 = stCoordinates[vertexIndex[index * 3]];
-        const Vector2f& st1 = stCoordinates[vertexIndex[index * 3 + 1]];
-        const Vector2f& st2 = stCoordinates[vertexIndex[index * 3 + 2]];
-        st = st0 * (1 - uv.x - uv.y) + st1 * uv.x + st2 * uv.y;
+        N = faceNormal((int)index);
     }
 
     Vector3f evalDiffuseColor(const Vector2f& st) const
@@ -194,9 +468,28 @@ public:
 
         return intersec;
     }
+
+    void getIntersectionPacket(const Ray* rays, int count, uint32_t activeMask, Intersection* hits) override
+    {
+        if (bvh)
+            bvh->IntersectPacket(rays, count, activeMask, hits);
+    }
+
+    uint32_t intersectPacketP(const Ray* rays, int count, uint32_t activeMask) override
+    {
+        return bvh ? bvh->IntersectPPacket(rays, count, activeMask) : 0;
+    }
     
-    void Sample(Intersection &pos, float &pdf){
-        bvh->Sample(pos, pdf);
+    // 按面积选一个三角形再在上面均匀取点, 整个网格上的 pdf 就是 1 / area
+    void Sample(Intersection &pos, float &pdf, Sampler &sampler){
+        std::call_once(tableOnce, [&] { buildTriangleTable(std::vector<int32_t>()); });
+        int k = triangleTable.Sample(sampler.Get1D());
+        int tri = tableTriangle.empty() ? k : tableTriangle[k];
+        Vector2f u = sampler.Get2D();
+        float x = std::sqrt(u.x), y = u.y;
+        pos.coords = vertex(tri, 0) * (1.0f - x) + vertex(tri, 1) * (x * (1.0f - y)) + vertex(tri, 2) * (x * y);
+        pos.normal = faceNormal(tri);
+        pdf = 1.0f / area;
         pos.emit = m->getEmission();
     }
     float getArea(){
@@ -207,20 +500,46 @@ public:
     }
 
     Bounds3 bounding_box;
-    std::unique_ptr<Vector3f[]> vertices;
-    uint32_t numTriangles;
-    std::unique_ptr<uint32_t[]> vertexIndex;
-    std::unique_ptr<Vector2f[]> stCoordinates;
-
-    std::vector<Triangle> triangles;
-
-    BVHAccel* bvh;
+    MappedArray<Vector3f> positions;    // 所有三角形共用的顶点
+    MappedArray<uint32_t> indices;      // 每个三角形 3 个顶点下标, 按 BVH 叶子的顺序
+
+    int blockWidth;
+    MappedArray<TriangleBlock<4>> blocks4;
+    MappedArray<TriangleBlock<8>> blocks8;
+    std::unique_ptr<MappedFile> mappedCache;    // 从缓存读出时顶点, 索引, BVH 和块都指向它
+    AliasTable triangleTable;       // 只有采样过的 (发光的) 网格才会建
+    std::vector<int> tableTriangle; // 别名表的第 k 项 -> 三角形, 为空时就是 k
+    std::once_flag tableOnce;
+
+    std::unique_ptr<BVHAccel> bvh;
     float area;
 
     Material* m;
 };
 
-inline bool Triangle::intersect(const Ray& ray) { return true; }
+// 与 getIntersection 相同的背面剔除和判定, 但只回答是否在 [0, ray.t_max) 内相交
+inline bool Triangle::intersect(const Ray& ray)
+{
+    STAT_ADD(kStatTriangleTests, 1);
+    if (dotProduct(ray.direction, normal) > 0)
+        return false;
+    Vector3f s1 = crossProduct(ray.direction, e2);
+    double det = dotProduct(e1, s1);
+    if (det == 0)
+        return false;
+
+    double det_inv = 1. / det;
+    Vector3f s = ray.origin - v0;
+    double u = dotProduct(s, s1) * det_inv;
+    if (u < 0 || u > 1)
+        return false;
+    Vector3f s2 = crossProduct(s, e1);
+    double v = dotProduct(ray.direction, s2) * det_inv;
+    if (v < 0 || u + v > 1)
+        return false;
+    double tnear = dotProduct(e2, s2) * det_inv;
+    return tnear >= 0 && tnear < ray.t_max;
+}
 inline bool Triangle::intersect(const Ray& ray, float& tnear,
                                 uint32_t& index) const
 {
@@ -233,12 +552,13 @@ inline Intersection Triangle::getIntersection(Ray ray)
 {
     Intersection inter;
 
+    STAT_ADD(kStatTriangleTests, 1);
     if (dotProduct(ray.direction, normal) > 0)
         return inter;
     double u, v, tnear = 0;
     Vector3f s1 = crossProduct(ray.direction, e2);
     double det = dotProduct(e1, s1);
-    if (fabs(det) < EPSILON)
+    if (det == 0)
         return inter;
 
     double det_inv = 1. / det;
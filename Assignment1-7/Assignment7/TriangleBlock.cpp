@@ -0,0 +1,140 @@
+//
+// SIMD ray-triangle intersection for packed triangle blocks.
+//
+
+#include "TriangleBlock.hpp"
+#include "global.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#include <immintrin.h>
+
+namespace tri4 {
+
+constexpr int W = 4;
+using vfloat = __m128;
+
+inline vfloat Set1(float x) { return _mm_set1_ps(x); }
+inline vfloat Load(const float* p) { return _mm_load_ps(p); }
+inline void Store(float* p, vfloat a) { _mm_store_ps(p, a); }
+inline vfloat Add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat Sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat Mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat Div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat Greater(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+inline vfloat GreaterEq(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+inline vfloat LessEq(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+inline vfloat Less(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat And(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+inline int MoveMask(vfloat a) { return _mm_movemask_ps(a); }
+
+#include "TriangleBlock.inl"
+
+} // namespace tri4
+
+// 8 宽的块用 AVX2 编译, 只有 CpuSupportsAVX2() 为真时 MeshTriangle 才会用它
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define TRIANGLE_BLOCK_POP_OPTIONS
+#endif
+
+namespace tri8 {
+
+constexpr int W = 8;
+using vfloat = __m256;
+
+inline vfloat Set1(float x) { return _mm256_set1_ps(x); }
+inline vfloat Load(const float* p) { return _mm256_load_ps(p); }
+inline void Store(float* p, vfloat a) { _mm256_store_ps(p, a); }
+inline vfloat Add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat Sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat Mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat Div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat Greater(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline vfloat GreaterEq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline vfloat LessEq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline vfloat Less(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat And(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+inline int MoveMask(vfloat a) { return _mm256_movemask_ps(a); }
+
+#include "TriangleBlock.inl"
+
+} // namespace tri8
+
+bool IntersectTriangleBlock8(const TriangleBlock<8>& block, int laneMask, const Ray& ray, float& tMax,
+                             HitRecord& hit)
+{
+    return tri8::Intersect(block, laneMask, ray, tMax, hit);
+}
+
+bool IntersectTriangleBlockP8(const TriangleBlock<8>& block, int laneMask, const Ray& ray, float tMax)
+{
+    return tri8::IntersectP(block, laneMask, ray, tMax);
+}
+
+#ifdef TRIANGLE_BLOCK_POP_OPTIONS
+#pragma GCC pop_options
+#undef TRIANGLE_BLOCK_POP_OPTIONS
+#endif
+
+#else
+
+// 非 x86 平台用普通数组模拟 4 个 lane, 8 宽的块不会被用到
+namespace tri4 {
+
+constexpr int W = 4;
+struct vfloat {
+    float x[W];
+};
+
+template <typename F>
+inline vfloat Map(vfloat a, vfloat b, F f)
+{
+    vfloat r;
+    for (int i = 0; i < W; ++i)
+        r.x[i] = f(a.x[i], b.x[i]);
+    return r;
+}
+
+inline float MaskBits(bool b) { return b ? -1.0f : 0.0f; }
+
+inline vfloat Set1(float x) { return { { x, x, x, x } }; }
+inline vfloat Load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+inline void Store(float* p, vfloat a) { for (int i = 0; i < W; ++i) p[i] = a.x[i]; }
+inline vfloat Add(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return x + y; }); }
+inline vfloat Sub(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return x - y; }); }
+inline vfloat Mul(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return x * y; }); }
+inline vfloat Div(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return x / y; }); }
+inline vfloat Greater(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return MaskBits(x > y); }); }
+inline vfloat GreaterEq(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return MaskBits(x >= y); }); }
+inline vfloat LessEq(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return MaskBits(x <= y); }); }
+inline vfloat Less(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return MaskBits(x < y); }); }
+inline vfloat And(vfloat a, vfloat b) { return Map(a, b, [](float x, float y) { return MaskBits(x != 0 && y != 0); }); }
+inline int MoveMask(vfloat a)
+{
+    int mask = 0;
+    for (int i = 0; i < W; ++i)
+        mask |= (a.x[i] != 0) << i;
+    return mask;
+}
+
+#include "TriangleBlock.inl"
+
+} // namespace tri4
+
+bool IntersectTriangleBlock8(const TriangleBlock<8>&, int, const Ray&, float&, HitRecord&) { return false; }
+bool IntersectTriangleBlockP8(const TriangleBlock<8>&, int, const Ray&, float) { return false; }
+
+#endif
+
+bool IntersectTriangleBlock4(const TriangleBlock<4>& block, int laneMask, const Ray& ray, float& tMax,
+                             HitRecord& hit)
+{
+    return tri4::Intersect(block, laneMask, ray, tMax, hit);
+}
+
+bool IntersectTriangleBlockP4(const TriangleBlock<4>& block, int laneMask, const Ray& ray, float tMax)
+{
+    return tri4::IntersectP(block, laneMask, ray, tMax);
+}
@@ -0,0 +1,31 @@
+//
+// Packed triangles for SIMD ray-triangle intersection.
+//
+
+#ifndef RAYTRACING_TRIANGLEBLOCK_H
+#define RAYTRACING_TRIANGLEBLOCK_H
+
+#include "Ray.hpp"
+
+// W 个三角形按 SoA 存放, 一次 Moller-Trumbore 测完整个块.
+// 网格的三角形按顺序连续装进块里, 第 i 个三角形在第 i / W 块的第 i % W 个 lane,
+// 最后一块不满 W 个时剩下的槽位边长为 0 (det = 0), 永远不会命中.
+template <int W>
+struct alignas(W * 4) TriangleBlock {
+    float v0[3][W];
+    float e1[3][W];     // v1 - v0
+    float e2[3][W];     // v2 - v0
+};
+
+// 只测 laneMask 中的 lane (叶子的三角形区间可以从块的中间开始),
+// 找 [0, tMax) 内最近的正面交点, 找到时更新 tMax 和 hit, hit.index 是命中的 lane.
+// 与 Triangle::getIntersection 一样剔除背面和与光线平行 (det = 0) 的三角形.
+bool IntersectTriangleBlock4(const TriangleBlock<4>& block, int laneMask, const Ray& ray, float& tMax,
+                             HitRecord& hit);
+bool IntersectTriangleBlock8(const TriangleBlock<8>& block, int laneMask, const Ray& ray, float& tMax,
+                             HitRecord& hit);
+// 遮挡查询, laneMask 中任意一个三角形在 [0, tMax) 内相交就返回 true
+bool IntersectTriangleBlockP4(const TriangleBlock<4>& block, int laneMask, const Ray& ray, float tMax);
+bool IntersectTriangleBlockP8(const TriangleBlock<8>& block, int laneMask, const Ray& ray, float tMax);
+
+#endif //RAYTRACING_TRIANGLEBLOCK_H
@@ -0,0 +1,75 @@
+//
+// SIMD Moller-Trumbore shared by the 4-wide (SSE) and 8-wide (AVX2) triangle blocks.
+// TriangleBlock.cpp includes this file once per width, inside a namespace that defines
+// W, vfloat and the lane operations Set1/Load/Store/Add/Sub/Mul/Div/Greater/GreaterEq/
+// LessEq/Less/And/MoveMask.
+//
+
+// 返回 laneMask 中所有通过测试的 lane 的掩码, t/u/v 存进数组
+inline int TestBlock(const TriangleBlock<W>& block, int laneMask, const Ray& ray, float tMax,
+                     float* tOut, float* uOut, float* vOut)
+{
+    vfloat dx = Set1(ray.direction.x), dy = Set1(ray.direction.y), dz = Set1(ray.direction.z);
+    vfloat e1x = Load(block.e1[0]), e1y = Load(block.e1[1]), e1z = Load(block.e1[2]);
+    vfloat e2x = Load(block.e2[0]), e2y = Load(block.e2[1]), e2z = Load(block.e2[2]);
+
+    // s1 = dir x e2, det = e1 . s1; det <= 0 是背面或者平行.
+    // det 随三角形大小和光线方向的长度缩放, 不能和固定的 EPSILON 比, 否则小模型和放大的实例会丢三角形
+    vfloat s1x = Sub(Mul(dy, e2z), Mul(dz, e2y));
+    vfloat s1y = Sub(Mul(dz, e2x), Mul(dx, e2z));
+    vfloat s1z = Sub(Mul(dx, e2y), Mul(dy, e2x));
+    vfloat det = Add(Add(Mul(e1x, s1x), Mul(e1y, s1y)), Mul(e1z, s1z));
+    vfloat mask = Greater(det, Set1(0.0f));
+    if (!(MoveMask(mask) & laneMask))
+        return 0;
+    vfloat invDet = Div(Set1(1.0f), det);
+
+    vfloat sx = Sub(Set1(ray.origin.x), Load(block.v0[0]));
+    vfloat sy = Sub(Set1(ray.origin.y), Load(block.v0[1]));
+    vfloat sz = Sub(Set1(ray.origin.z), Load(block.v0[2]));
+    vfloat u = Mul(Add(Add(Mul(sx, s1x), Mul(sy, s1y)), Mul(sz, s1z)), invDet);
+
+    // s2 = s x e1
+    vfloat s2x = Sub(Mul(sy, e1z), Mul(sz, e1y));
+    vfloat s2y = Sub(Mul(sz, e1x), Mul(sx, e1z));
+    vfloat s2z = Sub(Mul(sx, e1y), Mul(sy, e1x));
+    vfloat v = Mul(Add(Add(Mul(dx, s2x), Mul(dy, s2y)), Mul(dz, s2z)), invDet);
+    vfloat t = Mul(Add(Add(Mul(e2x, s2x), Mul(e2y, s2y)), Mul(e2z, s2z)), invDet);
+
+    vfloat zero = Set1(0.0f), one = Set1(1.0f);
+    mask = And(mask, And(GreaterEq(u, zero), LessEq(u, one)));
+    mask = And(mask, And(GreaterEq(v, zero), LessEq(Add(u, v), one)));
+    mask = And(mask, And(GreaterEq(t, zero), Less(t, Set1(tMax))));
+    int hitMask = MoveMask(mask) & laneMask;
+    if (hitMask) {
+        Store(tOut, t);
+        Store(uOut, u);
+        Store(vOut, v);
+    }
+    return hitMask;
+}
+
+bool Intersect(const TriangleBlock<W>& block, int laneMask, const Ray& ray, float& tMax, HitRecord& hit)
+{
+    alignas(32) float t[W], u[W], v[W];
+    int hitMask = TestBlock(block, laneMask, ray, tMax, t, u, v);
+    if (!hitMask)
+        return false;
+    int best = -1;
+    for (int i = 0; i < W; ++i) {
+        if ((hitMask & (1 << i)) && (best < 0 || t[i] < t[best]))
+            best = i;
+    }
+    tMax = t[best];
+    hit.t = t[best];
+    hit.u = u[best];
+    hit.v = v[best];
+    hit.index = best;
+    return true;
+}
+
+bool IntersectP(const TriangleBlock<W>& block, int laneMask, const Ray& ray, float tMax)
+{
+    alignas(32) float t[W], u[W], v[W];
+    return TestBlock(block, laneMask, ray, tMax, t, u, v) != 0;
+}
@@ -0,0 +1,223 @@
+//
+// Wavefront path tracer: the same estimator as Scene::castRay, run as a
+// sequence of data-parallel kernels over large ray queues.
+//
+
+#include <algorithm>
+#include "Wavefront.hpp"
+#include "Parallel.hpp"
+
+// 每一批最多同时追踪的路径数, 队列大约占几十 MB
+static const int kWaveSize = 1 << 16;
+
+WavefrontIntegrator::WavefrontIntegrator(const Scene& scene, const RenderOptions& options)
+    : scene(scene), options(options), camera(scene),
+      nThreads(options.threads > 0 ? options.threads : NumSystemCores())
+{
+}
+
+template <typename F>
+void WavefrontIntegrator::Kernel(int count, const F& func) const
+{
+    const int chunkSize = 1024;
+    ParallelFor((count + chunkSize - 1) / chunkSize, [&](int chunk, int) {
+        int end = std::min(count, (chunk + 1) * chunkSize);
+        for (int i = chunk * chunkSize; i < end; ++i)
+            func(i);
+    }, nThreads);
+}
+
+void WavefrontIntegrator::Render(Film& film, int nSamples)
+{
+    collectAOVs = film.HasAOVs();
+    // 记下每个活跃像素已有的样本数, 第 k 遍给它取编号 firstSample + k 的样本
+    std::vector<int> activePixels;
+    for (int m = 0; m < film.width * film.height; ++m) {
+        if (film.active[m])
+            activePixels.push_back(m);
+    }
+    std::vector<int> firstSample(film.width * film.height);
+    int64_t totalPaths = 0, pathsDone = 0;
+    for (int m : activePixels) {
+        firstSample[m] = (int)film.stats[m].n;
+        totalPaths += std::max(0, std::min(nSamples, options.spp - firstSample[m]));
+    }
+
+    UpdateProgress(0.f);
+    // 每个像素的样本按样本号从小到大累加, 与 RenderTile 的顺序相同
+    std::vector<int> pixels, sampleIndices;
+    for (int k = 0; k < nSamples; ++k) {
+        pixels.clear();
+        sampleIndices.clear();
+        for (int m : activePixels) {
+            if (firstSample[m] + k < options.spp) {
+                pixels.push_back(m);
+                sampleIndices.push_back(firstSample[m] + k);
+            }
+        }
+        for (int first = 0; first < (int)pixels.size(); first += kWaveSize) {
+            int nPixels = std::min(kWaveSize, (int)pixels.size() - first);
+            Generate(&pixels[first], &sampleIndices[first], nPixels);
+            for (int depth = 0; !rayPath.empty(); ++depth) {
+                STAT_ADD(depth == 0 ? kStatPrimaryRays : kStatIndirectRays, rayPath.size());
+                Extend();
+                Shade(depth);
+                STAT_PATH_VERTICES(depth, shadeQueue.size());
+                STAT_ADD(kStatShadowRays, shadeQueue.size());
+                TraceShadowRays();
+
+                // 把还没结束的路径压缩成下一跳的光线队列
+                rayOrigin.clear();
+                rayDirection.clear();
+                rayPath.clear();
+                for (size_t s = 0; s < shadeQueue.size(); ++s) {
+                    if (nextPath[s] < 0)
+                        continue;
+                    rayOrigin.push_back(nextOrigin[s]);
+                    rayDirection.push_back(nextDirection[s]);
+                    rayPath.push_back(nextPath[s]);
+                }
+            }
+            Accumulate(film);
+            pathsDone += nPixels;
+            UpdateProgress(pathsDone / (float)std::max<int64_t>(1, totalPaths));
+        }
+    }
+    UpdateProgress(1.f);
+}
+
+void WavefrontIntegrator::Generate(const int* pixels, const int* sampleIndices, int nPixels)
+{
+    pathPixel.assign(pixels, pixels + nPixels);
+    pathSampler.assign(nPixels, Sampler(options.sampler, options.seed));
+    pathBeta.assign(nPixels, Vector3f(1.0f));
+    pathRadiance.assign(nPixels, Vector3f());
+    pathBsdfPdf.assign(nPixels, 0.0f);
+    if (collectAOVs)
+        pathAOV.assign(nPixels, AOVSample());
+    rayOrigin.resize(nPixels);
+    rayDirection.resize(nPixels);
+    rayPath.resize(nPixels);
+
+    Kernel(nPixels, [&](int p) {
+        int m = pathPixel[p];
+        pathSampler[p].StartPixelSample(m, sampleIndices[p]);
+        Vector2f jitter = pathSampler[p].Get2D();
+        Ray ray = camera.GenerateRay(m % scene.width, m / scene.width, jitter);
+        rayOrigin[p] = ray.origin;
+        rayDirection[p] = ray.direction;
+        rayPath[p] = p;
+    });
+}
+
+void WavefrontIntegrator::Extend()
+{
+    rayHit.resize(rayPath.size());
+    Kernel((int)rayPath.size(), [&](int r) {
+        rayHit[r] = scene.intersect(Ray(rayOrigin[r], rayDirection[r]));
+    });
+}
+
+void WavefrontIntegrator::Shade(int depth)
+{
+    // 没打中或打中光源的路径到此结束. 相机光线直接看到光源时计入全部自发光,
+    // 反弹之后打中光源时按 BSDF 采样一侧的 MIS 权重计入, 与 indirectLight 相同
+    shadeQueue.clear();
+    for (int r = 0; r < (int)rayPath.size(); ++r) {
+        const Intersection& hit = rayHit[r];
+        if (!hit.happened)
+            continue;
+        int p = rayPath[r];
+        if (depth == 0 && collectAOVs)
+            pathAOV[p] = FirstHitAOV(hit);
+        if (hit.m->hasEmission()) {
+            if (depth == 0)
+                pathRadiance[p] += pathBeta[p] * hit.m->getEmission();
+            else
+                pathRadiance[p] += pathBeta[p]
+                    * scene.emittedLight(Ray(rayOrigin[r], rayDirection[r]), hit, pathBsdfPdf[p]);
+            continue;
+        }
+        // 超过最大深度的表面不再着色
+        if (depth > scene.maxDepth)
+            continue;
+        shadeQueue.push_back(r);
+    }
+
+    // 按材质排序, 让同一种材质的着色代码和数据连续执行
+    std::sort(shadeQueue.begin(), shadeQueue.end(), [&](int a, int b) {
+        Material* ma = rayHit[a].m;
+        Material* mb = rayHit[b].m;
+        if (ma->getType() != mb->getType())
+            return ma->getType() < mb->getType();
+        if (ma != mb)
+            return ma < mb;
+        return a < b;
+    });
+
+    int n = (int)shadeQueue.size();
+    shadowOrigin.resize(n);
+    shadowDirection.resize(n);
+    shadowContribution.resize(n);
+    shadowDistance.resize(n);
+    nextOrigin.resize(n);
+    nextDirection.resize(n);
+    nextPath.resize(n);
+
+    Kernel(n, [&](int s) {
+        int r = shadeQueue[s];
+        int p = rayPath[r];
+        const Intersection& hit = rayHit[r];
+        Sampler& sampler = pathSampler[p];
+        Ray ray(rayOrigin[r], rayDirection[r]);
+
+        // 直接光照: 先按没有遮挡算好贡献, 交给 Shadow 阶段判断可见性
+        Intersection lightInter;
+        float lightPDF;
+        scene.sampleLight(lightInter, lightPDF, sampler);
+        Vector3f objToLightDir(lightInter.coords - hit.coords);
+        shadowOrigin[s] = hit.coords;
+        shadowDirection[s] = objToLightDir.normalized();
+        shadowDistance[s] = objToLightDir.norm() - 0.001f;
+        shadowContribution[s] = pathBeta[p] * scene.directLight(ray, hit, lightInter, lightPDF);
+
+        // 间接光照: 即使这里已经是最大深度, 下一跳也要追踪, 看它是否打中光源
+        nextPath[s] = -1;
+        if (sampler.Get1D() < scene.RussianRoulette) {
+            Material* material = hit.m;
+            Vector3f sampleDir = material->sample(ray.direction, hit.normal, sampler).normalized();
+            float pdf = material->pdf(ray.direction, sampleDir, hit.normal);
+            if (pdf > 0) {
+                nextOrigin[s] = hit.coords;
+                nextDirection[s] = sampleDir;
+                nextPath[s] = p;
+                pathBsdfPdf[p] = pdf;
+                pathBeta[p] = pathBeta[p]
+                    * material->eval(ray.direction, sampleDir, hit.normal)
+                    * dotProduct(sampleDir, hit.normal)
+                    / pdf
+                    / scene.RussianRoulette;
+            }
+        }
+    });
+}
+
+void WavefrontIntegrator::TraceShadowRays()
+{
+    Kernel((int)shadeQueue.size(), [&](int s) {
+        if (!scene.intersectP(Ray(shadowOrigin[s], shadowDirection[s]), shadowDistance[s])) {
+            int p = rayPath[shadeQueue[s]];
+            pathRadiance[p] += shadowContribution[s];
+        }
+    });
+}
+
+void WavefrontIntegrator::Accumulate(Film& film)
+{
+    // 一批里每个像素只出现一次, 可以并行地加
+    Kernel((int)pathPixel.size(), [&](int p) {
+        film.AddSample(pathPixel[p], pathRadiance[p]);
+        if (collectAOVs)
+            film.AddAOV(pathPixel[p], pathAOV[p]);
+    });
+}
@@ -0,0 +1,69 @@
+//
+// Wavefront path tracer: the same estimator as Scene::castRay, run as a
+// sequence of data-parallel kernels over large ray queues.
+//
+
+#ifndef RAYTRACING_WAVEFRONT_H
+#define RAYTRACING_WAVEFRONT_H
+
+#include <vector>
+#include "Renderer.hpp"
+
+// castRay 对每条光线递归地求交, 采样光源, 着色, 做俄罗斯轮盘赌.
+// 这里把一批路径的同一跳放在一起处理:
+//   Generate   为一批像素生成相机光线
+//   Extend     整个光线队列求交
+//   Shade      按材质排序后采样光源和下一跳方向, 产生阴影光线和新的光线队列
+//   Shadow     整个阴影光线队列做遮挡查询, 没被挡住就累加直接光照
+//   Accumulate 把路径的结果加到 film
+// 每条路径有自己的 Sampler, 取随机数的顺序与 castRay 相同.
+class WavefrontIntegrator
+{
+public:
+    WavefrontIntegrator(const Scene& scene, const RenderOptions& options);
+
+    // 给每个活跃像素再渲染最多 nSamples 个样本 (不超过 options.spp), 加到 film 上
+    void Render(Film& film, int nSamples);
+
+private:
+    void Generate(const int* pixels, const int* sampleIndices, int nPixels);
+    void Extend();
+    void Shade(int depth);
+    void TraceShadowRays();
+    void Accumulate(Film& film);
+    // 把 [0, count) 切成小块交给 ParallelFor
+    template <typename F>
+    void Kernel(int count, const F& func) const;
+
+    const Scene& scene;
+    RenderOptions options;
+    Camera camera;
+    int nThreads;
+
+    // 路径状态, 下标是路径编号
+    std::vector<int> pathPixel;
+    std::vector<Sampler> pathSampler;
+    std::vector<Vector3f> pathBeta;         // 路径到当前这一跳的吞吐量
+    std::vector<Vector3f> pathRadiance;
+    std::vector<float> pathBsdfPdf;         // 上一跳 BSDF 采样方向的 pdf, 打中光源时算 MIS 权重
+    std::vector<AOVSample> pathAOV;         // 只在 film 需要 AOV 时使用
+    bool collectAOVs = false;
+
+    // 当前这一跳的光线队列
+    std::vector<Vector3f> rayOrigin, rayDirection;
+    std::vector<int> rayPath;
+    std::vector<Intersection> rayHit;
+
+    // 打中非光源表面的光线在队列中的下标, 按材质排序
+    std::vector<int> shadeQueue;
+
+    // 阴影光线, 与 shadeQueue 一一对应; 不被挡住时把 contribution 加到路径上
+    std::vector<Vector3f> shadowOrigin, shadowDirection, shadowContribution;
+    std::vector<float> shadowDistance;
+
+    // 着色产生的下一跳光线, 与 shadeQueue 一一对应, 路径结束时 nextPath 为 -1
+    std::vector<Vector3f> nextOrigin, nextDirection;
+    std::vector<int> nextPath;
+};
+
+#endif //RAYTRACING_WAVEFRONT_H
@@ -1,17 +1,31 @@
 #pragma once
 #include <iostream>
 #include <cmath>
-#include <random>
 
 #undef M_PI
 #define M_PI 3.141592653589793f
 
+// 模型目录. CMake 构建时是源码目录下的 models, 其他构建按工作目录找 models
+#ifndef RAYTRACING_MODEL_DIR
+#define RAYTRACING_MODEL_DIR "models"
+#endif
+
 extern const float  EPSILON;
 const float kInfinity = std::numeric_limits<float>::max();
 
 inline float clamp(const float &lo, const float &hi, const float &v)
 { return std::max(lo, std::min(hi, v)); }
 
+inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
+
+// 两种采样策略组合时的幂启发式 MIS 权重 (Veach 1997), f 是当前样本所用策略的 pdf
+inline float PowerHeuristic(float f, float g)
+{
+    if (f <= 0)
+        return 0;
+    return (f * f) / (f * f + g * g);
+}
+
 inline  bool solveQuadratic(const float &a, const float &b, const float &c, float &x0, float &x1)
 {
     float discr = b * b - 4 * a * c;
@@ -28,15 +42,6 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
     return true;
 }
 
-inline float get_random_float()
-{
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
-
-    return dist(rng);
-}
-
 inline void UpdateProgress(float progress)
 {
     int barWidth = 70;
@@ -2,9 +2,43 @@
 #include "Scene.hpp"
 #include "Triangle.hpp"
 #include "Sphere.hpp"
+#include "Instance.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+static void usage(const char* binaryName)
+{
+    printf("Usage: %s [options]\n", binaryName);
+    printf("Program Options:\n");
+    printf("  --threads <INT>    Number of render threads (default: all cores)\n");
+    printf("  --spp <INT>        Samples per pixel (default: 16)\n");
+    printf("  --seed <INT>       Random seed, same seed gives the same image\n");
+    printf("  --sampler <NAME>   pcg | sobol (default: sobol)\n");
+    printf("  --bvh <NAME>       naive | sah | hlbvh (parallel Morton-code build) (default: sah)\n");
+    printf("  --leaf-size <INT>  Max primitives per BVH leaf, 1-255 (default: 4)\n");
+    printf("  --no-packets       Trace camera and shadow rays one at a time\n");
+    printf("  --bvh-width <INT>  2 | 4 (SSE) | 8 (AVX2), BVH branching factor (default: 2)\n");
+    printf("  --integrator <NAME> recursive | wavefront (default: recursive)\n");
+    printf("  --pass-spp <INT>   Render in passes of this many spp, saving a checkpoint after each\n");
+    printf("  --checkpoint <FILE> Float accumulation file written after each pass\n");
+    printf("                     (default with --pass-spp: binary.accum)\n");
+    printf("  --resume <FILE>    Add samples to a checkpoint until it reaches --spp\n");
+    printf("  --adaptive <FLOAT> Stop sampling a pixel once its relative error is below this;\n");
+    printf("                     --spp becomes the per-pixel maximum (default: off)\n");
+    printf("  --min-spp <INT>    Samples per pixel before adaptive sampling may stop (default: 8)\n");
+    printf("  --aovs             Also write first-hit albedo.ppm, normal.ppm and depth.ppm\n");
+    printf("  --denoise          Denoise the result with an AOV-guided filter into denoised.ppm\n");
+    printf("  --glossy <NAME>    Give the tall box a GGX material: conductor | dielectric\n");
+    printf("  --roughness <FLOAT> Roughness of the --glossy material, 0-1 (default: 0.3)\n");
+    printf("  --instances <INT>  Replace the two boxes with this many instances of the tall box\n");
+    printf("  --no-mesh-cache    Always parse the OBJ files and rebuild the mesh BVHs instead of\n");
+    printf("                     memory-mapping the .cache files written next to them\n");
+    printf("  --models <DIR>     Directory containing cornellbox/ (default: the source tree's models)\n");
+    printf("\n");
+}
 
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
@@ -12,6 +46,116 @@
 // function().
 int main(int argc, char** argv)
 {
+    RenderOptions options;
+    int maxPrimsInNode = 4;
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
+    BVHAccel::TreeWidth treeWidth = BVHAccel::TreeWidth::BINARY;
+    MaterialType glossyType = DIFFUSE;
+    float roughness = 0.3f;
+    int nInstances = 0;
+    bool meshCache = true;
+    std::string modelDir = RAYTRACING_MODEL_DIR;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--spp") && i + 1 < argc)
+            options.spp = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--sampler") && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "pcg"))
+                options.sampler = SamplerType::PCG;
+            else if (!strcmp(name, "sobol"))
+                options.sampler = SamplerType::SOBOL;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--bvh") && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "naive"))
+                splitMethod = BVHAccel::SplitMethod::NAIVE;
+            else if (!strcmp(name, "sah"))
+                splitMethod = BVHAccel::SplitMethod::SAH;
+            else if (!strcmp(name, "hlbvh"))
+                splitMethod = BVHAccel::SplitMethod::HLBVH;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--leaf-size") && i + 1 < argc)
+            maxPrimsInNode = std::min(255, std::max(1, atoi(argv[++i])));
+        else if (!strcmp(argv[i], "--no-packets"))
+            options.packets = false;
+        else if (!strcmp(argv[i], "--bvh-width") && i + 1 < argc) {
+            int width = atoi(argv[++i]);
+            if (width == 2)
+                treeWidth = BVHAccel::TreeWidth::BINARY;
+            else if (width == 4)
+                treeWidth = BVHAccel::TreeWidth::BVH4;
+            else if (width == 8)
+                treeWidth = BVHAccel::TreeWidth::BVH8;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--integrator") && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "recursive"))
+                options.integrator = IntegratorType::RECURSIVE;
+            else if (!strcmp(name, "wavefront"))
+                options.integrator = IntegratorType::WAVEFRONT;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--pass-spp") && i + 1 < argc)
+            options.passSpp = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc)
+            options.checkpoint = argv[++i];
+        else if (!strcmp(argv[i], "--resume") && i + 1 < argc) {
+            options.checkpoint = argv[++i];
+            options.resume = true;
+        }
+        else if (!strcmp(argv[i], "--adaptive") && i + 1 < argc)
+            options.adaptiveThreshold = std::max(0.0f, (float)atof(argv[++i]));
+        else if (!strcmp(argv[i], "--min-spp") && i + 1 < argc)
+            options.adaptiveMinSpp = std::max(2, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--aovs"))
+            options.aovs = true;
+        else if (!strcmp(argv[i], "--denoise"))
+            options.denoise = true;
+        else if (!strcmp(argv[i], "--glossy") && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "conductor"))
+                glossyType = MICROFACET_CONDUCTOR;
+            else if (!strcmp(name, "dielectric"))
+                glossyType = MICROFACET_DIELECTRIC;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--roughness") && i + 1 < argc)
+            roughness = std::min(1.0f, std::max(0.0f, (float)atof(argv[++i])));
+        else if (!strcmp(argv[i], "--instances") && i + 1 < argc)
+            nInstances = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--no-mesh-cache"))
+            meshCache = false;
+        else if (!strcmp(argv[i], "--models") && i + 1 < argc)
+            modelDir = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.passSpp > 0 && options.checkpoint.empty())
+        options.checkpoint = "binary.accum";
 
     // Change the definition here to change resolution
     Scene scene(784/2, 784/2);
@@ -24,28 +168,64 @@ int main(int argc, char** argv)
     white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
     Material* light = new Material(DIFFUSE, (8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f) + 15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f) + 18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f)));
     light->Kd = Vector3f(0.65f);
+    // 金属取金的 F0, 电介质是白色漫反射上的一层清漆
+    Material* glossy = new Material(glossyType, Vector3f(0.0f));
+    glossy->Kd = white->Kd;
+    glossy->Ks = Vector3f(1.0f, 0.71f, 0.29f);
+    glossy->ior = 1.5f;
+    glossy->roughness = roughness;
 
-    std::string path = "D:/Code/Games101/Assignment7";
-    MeshTriangle floor(path + "/models/cornellbox/floor.obj", white);
-    MeshTriangle shortbox(path + "/models/cornellbox/shortbox.obj", white);
-    MeshTriangle tallbox(path + "/models/cornellbox/tallbox.obj", white);
-    MeshTriangle left(path + "/models/cornellbox/left.obj", red);
-    MeshTriangle right(path + "/models/cornellbox/right.obj", green);
-    MeshTriangle light_(path + "/models/cornellbox/light.obj", light);
+    std::string path = modelDir + "/cornellbox";
+    MeshTriangle floor(path + "/floor.obj", white, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    MeshTriangle shortbox(path + "/shortbox.obj", white, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    MeshTriangle tallbox(path + "/tallbox.obj", glossyType == DIFFUSE ? white : glossy, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    MeshTriangle left(path + "/left.obj", red, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    MeshTriangle right(path + "/right.obj", green, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    MeshTriangle light_(path + "/light.obj", light, maxPrimsInNode, splitMethod, treeWidth, meshCache);
+    for (const MeshTriangle* mesh : { &floor, &shortbox, &tallbox, &left, &right, &light_ }) {
+        if (!mesh->loaded())
+            return 1;
+    }
 
     scene.Add(&floor);
-    scene.Add(&shortbox);
-    scene.Add(&tallbox);
     scene.Add(&left);
     scene.Add(&right);
     scene.Add(&light_);
 
-    scene.buildBVH();
+    // 实例共享 tallbox 的三角形和 BVH, 在地板上排成网格, 每个缩小并转一个角度
+    std::vector<std::unique_ptr<Instance>> instances;
+    if (nInstances > 0) {
+        Bounds3 box = tallbox.getBounds();
+        Vector3f base(box.Centroid().x, box.pMin.y, box.Centroid().z);
+        int gridSize = (int)std::ceil(std::sqrt((float)nInstances));
+        float cell = 556.0f / gridSize;
+        float scale = 0.7f * cell / std::max(box.Diagonal().x, box.Diagonal().z);
+        for (int k = 0; k < nInstances; ++k) {
+            Vector3f position((k % gridSize + 0.5f) * cell, 0.0f, (k / gridSize + 0.5f) * cell);
+            Transform transform = Transform::Translate(position)
+                                * Transform::Rotate(37.0f * k, Vector3f(0, 1, 0))
+                                * Transform::Scale(scale)
+                                * Transform::Translate(-base);
+            instances.emplace_back(new Instance(&tallbox, transform));
+            scene.Add(instances.back().get());
+        }
+    }
+    else {
+        scene.Add(&shortbox);
+        scene.Add(&tallbox);
+    }
+
+    auto buildStart = std::chrono::steady_clock::now();
+    scene.buildBVH(maxPrimsInNode, splitMethod, treeWidth);
+    auto buildStop = std::chrono::steady_clock::now();
+    printf(" - Top-level BVH over %d objects: %.2f ms\n\n", (int)scene.objects.size(),
+           std::chrono::duration<double, std::milli>(buildStop - buildStart).count());
 
-    Renderer r;
+    Renderer r(options);
 
     auto start = std::chrono::system_clock::now();
-    r.Render(scene);
+    if (!r.Render(scene))
+        return 1;
     auto stop = std::chrono::system_clock::now();
 
     std::cout << "Render complete: \n";